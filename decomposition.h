@@ -0,0 +1,649 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_DECOMPOSITION_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_DECOMPOSITION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "ortools/base/integral_types.h"
+
+#include "ortools_vrp.pb.h"
+#include "ortools_result.pb.h"
+
+namespace operations_research {
+
+//  Runs job(0) to job(jobs - 1) over a pool of threads
+void ParallelFor(int jobs, int threads, const std::function<void(int)>& job) {
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < std::min(jobs, std::max(threads, 1)); ++t) {
+    workers.push_back(std::thread([&next, &job, jobs]() {
+      for (int j = next++; j < jobs; j = next++) job(j);
+    }));
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+//  Travel time between two locations averaged over both directions, read
+//  from the first matrix
+int64 LocationTime(const ortools_vrp::Problem& problem, int32 from, int32 to) {
+  if (from < 0 || to < 0 || problem.matrices_size() == 0) return 0;
+  const ortools_vrp::Matrix& matrix = problem.matrices(0);
+  const google::protobuf::RepeatedField<float>& costs = matrix.time_size() > 0 ? matrix.time() : matrix.distance();
+  const int32 size = sqrt(costs.size());
+  if (from >= size || to >= size) return 0;
+  return (static_cast<int64>(costs.Get(from * size + to)) + static_cast<int64>(costs.Get(to * size + from))) / 2;
+}
+
+int32 VehicleLocation(const ortools_vrp::Vehicle& vehicle) {
+  return vehicle.start_index() >= 0 ? vehicle.start_index() : vehicle.end_index();
+}
+
+//  Location of a route closest to its other locations, or the vehicle
+//  location when the route is empty. Long routes are sampled.
+int32 RouteLocation(const ortools_vrp::Problem& problem, const ortools_result::Route& route, const ortools_vrp::Vehicle& vehicle) {
+  std::vector<int32> locations;
+  for (const ortools_result::Activity& activity: route.activities()) {
+    if (activity.type() == "service") locations.push_back(problem.services(activity.index()).matrix_index());
+  }
+  if (locations.empty()) return VehicleLocation(vehicle);
+
+  const int stride = locations.size() / 32 + 1;
+  int32 best = locations[0];
+  int64 best_sum = kint64max;
+  for (int a = 0; a < locations.size(); a += stride) {
+    int64 sum = 0;
+    for (int b = 0; b < locations.size(); b += stride) {
+      sum += LocationTime(problem, locations[a], locations[b]);
+    }
+    if (sum < best_sum) {
+      best_sum = sum;
+      best = locations[a];
+    }
+  }
+  return best;
+}
+
+//  Whether any vehicle may serve the service: no restriction, or -1 among
+//  its vehicle indices
+bool AnyVehicle(const ortools_vrp::Service& service) {
+  return service.vehicle_indices_size() == 0 ||
+    std::find(service.vehicle_indices().begin(), service.vehicle_indices().end(), -1) != service.vehicle_indices().end();
+}
+
+bool DayLapseRelation(const ortools_vrp::Relation& relation) {
+  return relation.type() == "minimum_day_lapse" || relation.type() == "maximum_day_lapse";
+}
+
+//  Services linked by relations, which are always solved together, with the
+//  vehicles allowed to serve all of them. Day lapses may be left out when
+//  the days are decided beforehand.
+struct ServiceGroup {
+  ServiceGroup(int32 l, int64 s):
+    location(l), start(s), restricted(false){}
+  int32 location;
+  int64 start;
+  bool restricted;
+  std::vector<int> services;
+  std::vector<int32> vehicles;
+};
+
+std::vector<ServiceGroup> ServiceGroups(const ortools_vrp::Problem& problem, bool join_day_lapses = true) {
+  std::vector<int> parent(problem.services_size());
+  std::iota(parent.begin(), parent.end(), 0);
+  auto find = [&parent](int s) {
+    while (parent[s] != s) s = parent[s] = parent[parent[s]];
+    return s;
+  };
+
+  std::map<std::string, int> ids;
+  for (int s = 0; s < problem.services_size(); ++s) {
+    ids[problem.services(s).id()] = s;
+  }
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    if (!join_day_lapses && DayLapseRelation(relation)) continue;
+    int root = -1;
+    for (const std::string& id: relation.linked_ids()) {
+      std::map<std::string, int>::const_iterator it = ids.find(id);
+      if (it == ids.end()) continue;
+      if (root == -1) root = find(it->second);
+      else parent[find(it->second)] = root;
+    }
+  }
+
+  std::vector<ServiceGroup> groups;
+  std::map<int, int> group_indices;
+  for (int s = 0; s < problem.services_size(); ++s) {
+    const ortools_vrp::Service& service = problem.services(s);
+    const int root = find(s);
+    if (group_indices.count(root) == 0) {
+      group_indices[root] = groups.size();
+      groups.push_back(ServiceGroup(service.matrix_index(), service.time_windows_size() > 0 ? service.time_windows(0).start() : -1));
+    }
+    ServiceGroup& group = groups[group_indices[root]];
+    group.services.push_back(s);
+    if (!AnyVehicle(service)) {
+      std::vector<int32> allowed(service.vehicle_indices().begin(), service.vehicle_indices().end());
+      std::sort(allowed.begin(), allowed.end());
+      if (group.restricted) {
+        std::vector<int32> common;
+        std::set_intersection(group.vehicles.begin(), group.vehicles.end(), allowed.begin(), allowed.end(), std::back_inserter(common));
+        group.vehicles = common;
+      } else {
+        group.vehicles = allowed;
+        group.restricted = true;
+      }
+    }
+  }
+  return groups;
+}
+
+//  Groups are close when they are near in travel time and in opening time
+int64 GroupDistance(const ortools_vrp::Problem& problem, const ServiceGroup& a, const ServiceGroup& b) {
+  int64 distance = LocationTime(problem, a.location, b.location);
+  if (a.start >= 0 && b.start >= 0) distance += std::abs(a.start - b.start);
+  return distance;
+}
+
+//  Clusters of services with the vehicles serving them. Related services
+//  stay in the same cluster and restricted services are placed in a cluster
+//  owning one of their vehicles.
+struct Decomposition {
+  std::vector<int32> seeds;
+  std::vector<std::vector<int>> services;
+  std::vector<std::vector<int>> vehicles;
+};
+
+Decomposition ClusterProblem(const ortools_vrp::Problem& problem, int cluster_size) {
+  const std::vector<ServiceGroup> groups = ServiceGroups(problem);
+  const int size = problem.services_size();
+  const int size_vehicles = problem.vehicles_size();
+  const int clusters = std::max(1, std::min((size + cluster_size - 1) / cluster_size, std::min(size_vehicles, (int)groups.size())));
+
+  Decomposition decomposition;
+  decomposition.services.resize(clusters);
+  decomposition.vehicles.resize(clusters);
+  if (clusters == 1) {
+    decomposition.services[0].resize(size);
+    std::iota(decomposition.services[0].begin(), decomposition.services[0].end(), 0);
+    decomposition.vehicles[0].resize(size_vehicles);
+    std::iota(decomposition.vehicles[0].begin(), decomposition.vehicles[0].end(), 0);
+    decomposition.seeds.push_back(groups.size() > 0 ? groups[0].location : -1);
+    return decomposition;
+  }
+
+  // Seeds spread by farthest first traversal
+  std::vector<int> seeds;
+  std::vector<int64> seed_distance(groups.size(), kint64max);
+  int next_seed = 0;
+  while (seeds.size() < clusters) {
+    seeds.push_back(next_seed);
+    int64 farthest = -1;
+    for (int g = 0; g < groups.size(); ++g) {
+      seed_distance[g] = std::min(seed_distance[g], GroupDistance(problem, groups[g], groups[seeds.back()]));
+      if (seed_distance[g] > farthest) {
+        farthest = seed_distance[g];
+        next_seed = g;
+      }
+    }
+  }
+
+  // Closest groups first, each to its nearest seed with room left
+  const int64 capacity = size * 6 / (5 * clusters) + 1;
+  std::vector<int> order(groups.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&seed_distance](int a, int b) { return seed_distance[a] < seed_distance[b]; });
+  std::vector<int> group_cluster(groups.size(), -1);
+  std::vector<int64> loads(clusters, 0);
+  for (int g: order) {
+    int best = -1;
+    int64 best_distance = kint64max;
+    for (int c = 0; c < clusters; ++c) {
+      if (loads[c] > 0 && loads[c] + groups[g].services.size() > capacity) continue;
+      const int64 distance = GroupDistance(problem, groups[g], groups[seeds[c]]);
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = c;
+      }
+    }
+    if (best == -1) best = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    group_cluster[g] = best;
+    loads[best] += groups[g].services.size();
+  }
+
+  // One vehicle per cluster, then to the cluster with the most services per
+  // vehicle, nearest vehicles first
+  std::vector<int> vehicle_cluster(size_vehicles, -1);
+  std::vector<int> counts(clusters, 0);
+  for (int assigned = 0; assigned < size_vehicles; ++assigned) {
+    int cluster = std::find(counts.begin(), counts.end(), 0) - counts.begin();
+    if (cluster == clusters) {
+      double most = -1;
+      for (int c = 0; c < clusters; ++c) {
+        if ((double)loads[c] / counts[c] > most) {
+          most = (double)loads[c] / counts[c];
+          cluster = c;
+        }
+      }
+    }
+    int best = -1;
+    int64 best_distance = kint64max;
+    for (int v = 0; v < size_vehicles; ++v) {
+      if (vehicle_cluster[v] != -1) continue;
+      const int64 distance = LocationTime(problem, VehicleLocation(problem.vehicles(v)), groups[seeds[cluster]].location);
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = v;
+      }
+    }
+    vehicle_cluster[best] = cluster;
+    ++counts[cluster];
+  }
+
+  // Restricted groups move to the nearest cluster owning an allowed vehicle
+  for (int g = 0; g < groups.size(); ++g) {
+    if (!groups[g].restricted) continue;
+    int best = -1;
+    int64 best_distance = kint64max;
+    for (int32 v: groups[g].vehicles) {
+      if (v < 0 || v >= size_vehicles) continue;
+      if (vehicle_cluster[v] == group_cluster[g]) {
+        best = -1;
+        break;
+      }
+      const int64 distance = GroupDistance(problem, groups[g], groups[seeds[vehicle_cluster[v]]]);
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = vehicle_cluster[v];
+      }
+    }
+    if (best != -1) group_cluster[g] = best;
+  }
+
+  for (int c = 0; c < clusters; ++c) {
+    decomposition.seeds.push_back(groups[seeds[c]].location);
+  }
+  for (int g = 0; g < groups.size(); ++g) {
+    std::vector<int>& services = decomposition.services[group_cluster[g]];
+    services.insert(services.end(), groups[g].services.begin(), groups[g].services.end());
+  }
+  for (int v = 0; v < size_vehicles; ++v) {
+    decomposition.vehicles[vehicle_cluster[v]].push_back(v);
+  }
+  for (std::vector<int>& services: decomposition.services) {
+    std::sort(services.begin(), services.end());
+  }
+  return decomposition;
+}
+
+//  Each cluster paired with its nearest neighbour not paired yet
+std::vector<std::pair<int, int>> NeighbourPairs(const ortools_vrp::Problem& problem, const Decomposition& decomposition) {
+  std::vector<std::pair<int64, std::pair<int, int>>> candidates;
+  for (int a = 0; a < decomposition.seeds.size(); ++a) {
+    for (int b = a + 1; b < decomposition.seeds.size(); ++b) {
+      candidates.push_back(std::make_pair(LocationTime(problem, decomposition.seeds[a], decomposition.seeds[b]), std::make_pair(a, b)));
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+  std::vector<bool> paired(decomposition.seeds.size(), false);
+  std::vector<std::pair<int, int>> pairs;
+  for (const std::pair<int64, std::pair<int, int>>& candidate: candidates) {
+    if (paired[candidate.second.first] || paired[candidate.second.second]) continue;
+    paired[candidate.second.first] = paired[candidate.second.second] = true;
+    pairs.push_back(candidate.second);
+  }
+  return pairs;
+}
+
+//  Consecutive services of a day lapse relation
+struct DayLapse {
+  DayLapse(int p, int n, int32 l, bool m):
+    previous(p), next(n), lapse(l), minimum(m){}
+  int previous;
+  int next;
+  int32 lapse;
+  bool minimum;
+};
+
+std::vector<DayLapse> DayLapses(const ortools_vrp::Problem& problem) {
+  std::map<std::string, int> ids;
+  for (int s = 0; s < problem.services_size(); ++s) {
+    ids[problem.services(s).id()] = s;
+  }
+  std::vector<DayLapse> lapses;
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    if (!DayLapseRelation(relation)) continue;
+    int previous = -1;
+    for (const std::string& id: relation.linked_ids()) {
+      std::map<std::string, int>::const_iterator it = ids.find(id);
+      if (it == ids.end()) continue;
+      if (previous != -1) lapses.push_back(DayLapse(previous, it->second, relation.lapse(), relation.type() == "minimum_day_lapse"));
+      previous = it->second;
+    }
+  }
+  return lapses;
+}
+
+//  Narrows the days of a service to keep the lapses with the days of the
+//  services around it, -1 for a service without a day yet and -2 for a left
+//  out one. False when no day is left or a service before it is left out.
+bool LapseRange(const std::vector<DayLapse>& lapses, const std::vector<int32>& service_day, int s, int32* first, int32* last) {
+  for (const DayLapse& link: lapses) {
+    if (link.next == s) {
+      const int32 day = service_day[link.previous];
+      if (day == -2) return false;
+      if (day < 0) continue;
+      if (link.minimum) *first = std::max(*first, day + link.lapse);
+      else *last = std::min(*last, day + link.lapse);
+    } else if (link.previous == s) {
+      const int32 day = service_day[link.next];
+      if (day < 0) continue;
+      if (link.minimum) *last = std::min(*last, day - link.lapse);
+      else *first = std::max(*first, day - link.lapse);
+    }
+  }
+  return *first <= *last;
+}
+
+//  Whether a vehicle may serve a service, from its vehicle restrictions
+//  and, when it cannot be late, its time windows
+bool VehicleServes(const ortools_vrp::Problem& problem, int v, int s) {
+  const ortools_vrp::Service& service = problem.services(s);
+  if (!AnyVehicle(service) && std::find(service.vehicle_indices().begin(), service.vehicle_indices().end(), v) == service.vehicle_indices().end())
+    return false;
+  const ortools_vrp::Vehicle& vehicle = problem.vehicles(v);
+  if (service.time_windows_size() == 0 || service.late_multiplier() > 0 || !vehicle.has_time_window()) return true;
+  for (const ortools_vrp::TimeWindow& tw: service.time_windows()) {
+    if (tw.start() <= vehicle.time_window().end() && tw.end() >= vehicle.time_window().start()) return true;
+  }
+  return false;
+}
+
+//  Services of each day of a multi-day problem with the vehicles of that
+//  day. Groups of related services are given a day one of their vehicles
+//  works and the lapses with the days already given allow, groups in day
+//  lapses first by their earliest day, then the most constrained groups.
+//  Each goes to the nearest day with room left, or else the least loaded.
+struct DayDecomposition {
+  std::vector<int32> days;
+  std::vector<std::vector<int>> services;
+  std::vector<std::vector<int>> vehicles;
+  //  Days a group may go to, by position in days
+  std::vector<std::vector<int>> group_days;
+  //  Days of each service allowed by the lapses alone
+  std::vector<int32> first;
+  std::vector<int32> last;
+  std::vector<int> left_out;
+};
+
+DayDecomposition DayProblem(const ortools_vrp::Problem& problem, const std::vector<ServiceGroup>& groups, const std::vector<DayLapse>& lapses) {
+  DayDecomposition decomposition;
+  for (const ortools_vrp::Vehicle& vehicle: problem.vehicles()) {
+    decomposition.days.push_back(vehicle.day_index());
+  }
+  std::sort(decomposition.days.begin(), decomposition.days.end());
+  decomposition.days.erase(std::unique(decomposition.days.begin(), decomposition.days.end()), decomposition.days.end());
+  const int size_days = decomposition.days.size();
+  decomposition.services.resize(size_days);
+  decomposition.vehicles.resize(size_days);
+  for (int v = 0; v < problem.vehicles_size(); ++v) {
+    const int d = std::lower_bound(decomposition.days.begin(), decomposition.days.end(), problem.vehicles(v).day_index()) - decomposition.days.begin();
+    decomposition.vehicles[d].push_back(v);
+  }
+  if (size_days == 0) return decomposition;
+
+  const int size = problem.services_size();
+  decomposition.first.assign(size, decomposition.days.front());
+  decomposition.last.assign(size, decomposition.days.back());
+  for (int pass = 0; pass <= lapses.size(); ++pass) {
+    bool narrowed = false;
+    for (const DayLapse& link: lapses) {
+      if (!link.minimum) continue;
+      if (decomposition.first[link.previous] + link.lapse > decomposition.first[link.next]) {
+        decomposition.first[link.next] = decomposition.first[link.previous] + link.lapse;
+        narrowed = true;
+      }
+      if (decomposition.last[link.next] - link.lapse < decomposition.last[link.previous]) {
+        decomposition.last[link.previous] = decomposition.last[link.next] - link.lapse;
+        narrowed = true;
+      }
+    }
+    if (!narrowed) break;
+  }
+
+  std::vector<bool> in_lapse(size, false);
+  for (const DayLapse& link: lapses) {
+    in_lapse[link.previous] = in_lapse[link.next] = true;
+  }
+  decomposition.group_days.resize(groups.size());
+  std::vector<std::tuple<bool, int64, int>> keys(groups.size());
+  for (int g = 0; g < groups.size(); ++g) {
+    for (int d = 0; d < size_days; ++d) {
+      for (int v: decomposition.vehicles[d]) {
+        bool serves = true;
+        for (int s: groups[g].services) {
+          if (!VehicleServes(problem, v, s)) serves = false;
+        }
+        if (serves) {
+          decomposition.group_days[g].push_back(d);
+          break;
+        }
+      }
+    }
+    bool lapsed = false;
+    int32 earliest = decomposition.days.back();
+    for (int s: groups[g].services) {
+      lapsed = lapsed || in_lapse[s];
+      earliest = std::min(earliest, decomposition.first[s]);
+    }
+    keys[g] = std::make_tuple(!lapsed, lapsed ? earliest : (int64)decomposition.group_days[g].size(), g);
+  }
+  std::vector<int> order(groups.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] < keys[b]; });
+
+  const int64 capacity = size * 6 / (5 * std::max(problem.vehicles_size(), 1)) + 1;
+  std::vector<int64> loads(size_days, 0);
+  std::vector<int> seeds(size_days, -1);
+  std::vector<int32> service_day(size, -1);
+  for (int g: order) {
+    const ServiceGroup& group = groups[g];
+    int32 first = decomposition.days.front();
+    int32 last = decomposition.days.back();
+    bool allowed = true;
+    for (int s: group.services) {
+      first = std::max(first, decomposition.first[s]);
+      last = std::min(last, decomposition.last[s]);
+      allowed = allowed && LapseRange(lapses, service_day, s, &first, &last);
+    }
+
+    int best = -1;
+    int64 best_distance = kint64max;
+    for (int d: decomposition.group_days[g]) {
+      if (!allowed || decomposition.days[d] < first || decomposition.days[d] > last) continue;
+      if (loads[d] > 0 && loads[d] + group.services.size() > capacity * decomposition.vehicles[d].size()) continue;
+      const int64 distance = seeds[d] == -1 ? 0 : GroupDistance(problem, group, groups[seeds[d]]);
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = d;
+      }
+    }
+    if (best == -1) {
+      double lightest = -1;
+      for (int d: decomposition.group_days[g]) {
+        if (!allowed || decomposition.days[d] < first || decomposition.days[d] > last) continue;
+        const double load = (double)(loads[d] + group.services.size()) / decomposition.vehicles[d].size();
+        if (best == -1 || load < lightest) {
+          lightest = load;
+          best = d;
+        }
+      }
+    }
+
+    for (int s: group.services) {
+      service_day[s] = best == -1 ? -2 : decomposition.days[best];
+    }
+    if (best == -1) {
+      decomposition.left_out.insert(decomposition.left_out.end(), group.services.begin(), group.services.end());
+      continue;
+    }
+    if (seeds[best] == -1) seeds[best] = g;
+    loads[best] += group.services.size();
+    decomposition.services[best].insert(decomposition.services[best].end(), group.services.begin(), group.services.end());
+  }
+  for (std::vector<int>& services: decomposition.services) {
+    std::sort(services.begin(), services.end());
+  }
+  return decomposition;
+}
+
+void ReduceMatrix(const google::protobuf::RepeatedField<float>& costs, const std::vector<int32>& locations, google::protobuf::RepeatedField<float>* reduced) {
+  if (costs.size() == 0) return;
+  const int32 size = sqrt(costs.size());
+  reduced->Reserve(locations.size() * locations.size());
+  for (int32 from: locations) {
+    for (int32 to: locations) {
+      reduced->Add(costs.Get(from * size + to));
+    }
+  }
+}
+
+//  Problem restricted to the given services and vehicles. Matrices only keep
+//  the locations used, service_map gives the problem index of each service.
+//  Services none of the vehicles can serve and relations across the
+//  boundary are left out. Replaced vehicles are copied from the given map.
+ortools_vrp::Problem SubProblem(const ortools_vrp::Problem& problem, const std::vector<int>& services, const std::vector<int>& vehicles, std::vector<int>* service_map,
+                                const std::map<int, ortools_vrp::Vehicle>* replaced = NULL) {
+  ortools_vrp::Problem sub;
+  std::map<int32, int32> locations;
+  auto location = [&locations](int32 index) {
+    if (index < 0) return index;
+    std::map<int32, int32>::const_iterator it = locations.find(index);
+    if (it != locations.end()) return it->second;
+    const int32 new_index = locations.size();
+    locations[index] = new_index;
+    return new_index;
+  };
+
+  std::map<int32, int32> vehicle_indices;
+  std::set<std::string> vehicle_ids;
+  for (int v: vehicles) {
+    vehicle_indices[v] = sub.vehicles_size();
+    vehicle_ids.insert(problem.vehicles(v).id());
+    ortools_vrp::Vehicle* vehicle = sub.add_vehicles();
+    if (replaced != NULL && replaced->count(v) > 0) vehicle->CopyFrom(replaced->at(v));
+    else vehicle->CopyFrom(problem.vehicles(v));
+    vehicle->set_start_index(location(vehicle->start_index()));
+    vehicle->set_end_index(location(vehicle->end_index()));
+  }
+
+  std::set<std::string> service_ids;
+  service_map->clear();
+  for (int s: services) {
+    const ortools_vrp::Service& service = problem.services(s);
+    // Services any vehicle may serve stay unrestricted
+    const bool any_vehicle = AnyVehicle(service);
+    std::vector<int32> allowed;
+    if (!any_vehicle) {
+      for (int32 v: service.vehicle_indices()) {
+        std::map<int32, int32>::const_iterator it = vehicle_indices.find(v);
+        if (it != vehicle_indices.end()) allowed.push_back(it->second);
+      }
+      if (allowed.empty()) continue;
+    }
+    ortools_vrp::Service* copy = sub.add_services();
+    copy->CopyFrom(service);
+    copy->set_matrix_index(location(service.matrix_index()));
+    copy->clear_vehicle_indices();
+    for (int32 v: allowed) copy->add_vehicle_indices(v);
+    service_ids.insert(service.id());
+    service_map->push_back(s);
+  }
+
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    bool inside = true;
+    for (const std::string& id: relation.linked_ids()) {
+      if (service_ids.count(id) == 0) inside = false;
+    }
+    if (inside) sub.add_relations()->CopyFrom(relation);
+  }
+
+  for (const ortools_vrp::Route& route: problem.routes()) {
+    if (vehicle_ids.count(route.vehicle_id()) == 0) continue;
+    ortools_vrp::Route* copy = sub.add_routes();
+    copy->set_vehicle_id(route.vehicle_id());
+    for (const std::string& id: route.service_ids()) {
+      if (service_ids.count(id) > 0) copy->add_service_ids(id);
+    }
+  }
+
+  std::vector<int32> origins(locations.size());
+  for (const std::pair<const int32, int32>& it: locations) {
+    origins[it.second] = it.first;
+  }
+  for (const ortools_vrp::Matrix& matrix: problem.matrices()) {
+    ortools_vrp::Matrix* reduced = sub.add_matrices();
+    ReduceMatrix(matrix.time(), origins, reduced->mutable_time());
+    ReduceMatrix(matrix.distance(), origins, reduced->mutable_distance());
+    ReduceMatrix(matrix.value(), origins, reduced->mutable_value());
+  }
+  return sub;
+}
+
+//  Replaces the routes of a sub-problem by the current routes of its vehicles
+void SetRoutesFromResult(const ortools_result::Result& result, const std::vector<int>& vehicles, ortools_vrp::Problem* sub) {
+  sub->clear_routes();
+  for (int v: vehicles) {
+    const ortools_result::Route& current = result.routes(v);
+    ortools_vrp::Route* route = sub->add_routes();
+    route->set_vehicle_id(current.vehicle_id());
+    for (const ortools_result::Activity& activity: current.activities()) {
+      if (activity.type() == "service") route->add_service_ids(activity.id());
+    }
+  }
+}
+
+//  Result with an empty route for every vehicle of the problem
+ortools_result::Result EmptyResult(const ortools_vrp::Problem& problem) {
+  ortools_result::Result result;
+  for (const ortools_vrp::Vehicle& vehicle: problem.vehicles()) {
+    ortools_result::Route* route = result.add_routes();
+    route->set_vehicle_id(vehicle.id());
+    ortools_result::Activity* start = route->add_activities();
+    start->set_index(problem.services_size());
+    start->set_start_time(vehicle.time_window().start());
+    start->set_type("start");
+    ortools_result::Activity* end = route->add_activities();
+    end->set_index(problem.services_size() + 1);
+    end->set_start_time(vehicle.time_window().start());
+    end->set_type("end");
+  }
+  return result;
+}
+
+//  Copies the routes of a sub-problem result over the routes of the problem
+//  vehicles, with activity indices mapped back to the problem
+void MergeSubResult(const ortools_vrp::Problem& problem, const ortools_result::Result& sub_result, const std::vector<int>& service_map, const std::vector<int>& vehicles, ortools_result::Result* result) {
+  for (int r = 0; r < sub_result.routes_size() && r < vehicles.size(); ++r) {
+    ortools_result::Route* route = result->mutable_routes(vehicles[r]);
+    route->CopyFrom(sub_result.routes(r));
+    for (ortools_result::Activity& activity: *route->mutable_activities()) {
+      if (activity.type() == "service") activity.set_index(service_map[activity.index()]);
+      else if (activity.type() == "start") activity.set_index(problem.services_size());
+      else if (activity.type() == "end") activity.set_index(problem.services_size() + 1);
+    }
+  }
+}
+
+}  //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_DECOMPOSITION_H
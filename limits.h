@@ -1,12 +1,20 @@
 #ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_LIMITS_H
 #define OR_TOOLS_TUTORIALS_CPLUSPLUS_LIMITS_H
 
+#include <atomic>
 #include <ostream>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 #include "ortools/base/bitmap.h"
@@ -19,136 +27,446 @@
 
 #include "ortools/constraint_solver/constraint_solver.h"
 
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+
 #include "ortools_result.pb.h"
 
 namespace operations_research {
 namespace {
 
-//  Don't use this class within a MakeLimit factory method!
-class NoImprovementLimit : public SearchLimit {
+//  One reason to stop the search. Times are in ms since the search start
+//  and costs are objective values.
+class StopCriterion {
   public:
-    NoImprovementLimit(Solver * const solver, IntVar * const objective_var, int64 solution_nbr_tolerance, double time_out, int64 time_out_coef, const bool minimize = true) :
-    SearchLimit(solver),
-      solver_(solver), prototype_(new Assignment(solver_)),
+    virtual ~StopCriterion() {}
+    virtual void Init() {}
+    virtual void AtSolution(int64 cost, double now) {}
+    virtual bool Check(double now) = 0;
+    virtual std::string Name() const = 0;
+};
+
+//  Former NoImprovementLimit: stops after a number of solutions without
+//  a 1% improvement, or once the time out is over. The time out grows
+//  with the time of the last improvement.
+class NoImprovementCriterion : public StopCriterion {
+  public:
+    NoImprovementCriterion(int64 solution_nbr_tolerance, double time_out, int64 time_out_coef) :
       solution_nbr_tolerance_(solution_nbr_tolerance),
-      start_time_(base::GetCurrentTimeNanos()),
-      nbr_solutions_with_no_better_obj_(0),
-      minimize_(minimize),
       initial_time_out_(time_out),
       time_out_(time_out),
       time_out_coef_(time_out_coef),
-      first_solution_(true),
-      limit_reached_(false) {
-        if (minimize_) {
-          best_result_ = kint64max;
-        } else {
-          best_result_ = kint64min;
-        }
+      best_result_(kint64max),
+      nbr_solutions_with_no_better_obj_(0),
+      first_solution_(true) {}
+
+    virtual void Init() {
+      nbr_solutions_with_no_better_obj_ = 0;
+      best_result_ = kint64max;
+    }
+
+    virtual void AtSolution(int64 cost, double now) {
+      if (cost * 1.01 < best_result_) {
+        first_solution_ = false;
+        best_result_ = cost;
+        nbr_solutions_with_no_better_obj_ = 0;
+        if (initial_time_out_ > 0) time_out_ = std::max(initial_time_out_ - now, time_out_coef_ * now);
+      }
+      ++nbr_solutions_with_no_better_obj_;
+    }
 
+    virtual bool Check(double now) {
+      return !first_solution_ && (nbr_solutions_with_no_better_obj_ > solution_nbr_tolerance_ && solution_nbr_tolerance_ > 0 || now > time_out_ && initial_time_out_ > 0);
+    }
+
+    virtual std::string Name() const { return "no improvement"; }
+
+  private:
+    int64 solution_nbr_tolerance_;
+    double initial_time_out_;
+    double time_out_;
+    int64 time_out_coef_;
+    int64 best_result_;
+    int64 nbr_solutions_with_no_better_obj_;
+    bool first_solution_;
+};
+
+class WallTimeCriterion : public StopCriterion {
+  public:
+    explicit WallTimeCriterion(double time_limit) : time_limit_(time_limit) {}
+
+    virtual bool Check(double now) {
+      return now > time_limit_;
+    }
+
+    virtual std::string Name() const { return "wall time"; }
+
+  private:
+    const double time_limit_;
+};
+
+//  Stops when the best cost has not improved by the given ratio for the
+//  plateau duration
+class PlateauCriterion : public StopCriterion {
+  public:
+    PlateauCriterion(double plateau, double tolerance) :
+      plateau_(plateau), tolerance_(tolerance), best_result_(kint64max), last_improvement_(-1) {}
+
+    virtual void AtSolution(int64 cost, double now) {
+      if (best_result_ == kint64max || cost < best_result_ * (1 - tolerance_)) {
+        best_result_ = cost;
+        last_improvement_ = now;
+      }
+    }
+
+    virtual bool Check(double now) {
+      return last_improvement_ >= 0 && now - last_improvement_ > plateau_;
+    }
+
+    virtual std::string Name() const { return "plateau"; }
+
+  private:
+    const double plateau_;
+    const double tolerance_;
+    int64 best_result_;
+    double last_improvement_;
+};
+
+//  Stops when the best cost improved by less than the given ratio over the
+//  last window
+class ImprovementRateCriterion : public StopCriterion {
+  public:
+    ImprovementRateCriterion(double window, double min_rate) :
+      window_(window), min_rate_(min_rate) {}
+
+    virtual void AtSolution(int64 cost, double now) {
+      if (history_.empty() || cost < history_.back().second) history_.push_back(std::make_pair(now, cost));
+    }
+
+    virtual bool Check(double now) {
+      if (history_.empty() || now - history_.front().first < window_) return false;
+      // Best cost at the start of the window
+      while (history_.size() > 1 && history_[1].first <= now - window_) history_.pop_front();
+      const int64 reference = history_.front().second;
+      if (reference <= 0) return false;
+      return (double)(reference - history_.back().second) / reference < min_rate_;
+    }
+
+    virtual std::string Name() const { return "improvement rate"; }
+
+  private:
+    const double window_;
+    const double min_rate_;
+    std::deque<std::pair<double, int64>> history_;
+};
+
+//  Stops once the best cost is within the given ratio of a lower bound,
+//  read as it becomes known while searching
+class GapCriterion : public StopCriterion {
+  public:
+    GapCriterion(double gap, const std::shared_ptr<std::atomic<int64>>& lower_bound) :
+      gap_(gap), lower_bound_(lower_bound), best_result_(kint64max) {}
+
+    virtual void AtSolution(int64 cost, double now) {
+      best_result_ = std::min(best_result_, cost);
+    }
+
+    virtual bool Check(double now) {
+      const int64 lower_bound = lower_bound_->load();
+      if (lower_bound == kint64min || best_result_ == kint64max || best_result_ <= 0) return false;
+      return (double)(best_result_ - lower_bound) / best_result_ <= gap_;
+    }
+
+    virtual std::string Name() const { return "gap"; }
+
+  private:
+    const double gap_;
+    const std::shared_ptr<std::atomic<int64>> lower_bound_;
+    int64 best_result_;
+};
+
+class SolutionCountCriterion : public StopCriterion {
+  public:
+    explicit SolutionCountCriterion(int64 solution_limit) :
+      solution_limit_(solution_limit), solutions_(0) {}
+
+    virtual void Init() {
+      solutions_ = 0;
+    }
+
+    virtual void AtSolution(int64 cost, double now) {
+      ++solutions_;
+    }
+
+    virtual bool Check(double now) {
+      return solutions_ >= solution_limit_;
+    }
+
+    virtual std::string Name() const { return "solution count"; }
+
+  private:
+    const int64 solution_limit_;
+    int64 solutions_;
+};
+
+//  Stops the search as soon as one of its criteria is met. Clones share
+//  the criteria.
+//  Don't use this class within a MakeLimit factory method!
+class StoppingPolicy : public SearchLimit {
+  public:
+    StoppingPolicy(Solver * const solver, IntVar * const objective_var, std::shared_ptr<std::vector<std::unique_ptr<StopCriterion>>> criteria) :
+    SearchLimit(solver),
+      solver_(solver), prototype_(new Assignment(solver_)),
+      criteria_(criteria),
+      start_time_(base::GetCurrentTimeNanos()),
+      limit_reached_(false) {
       CHECK_NOTNULL(objective_var);
       prototype_->AddObjective(objective_var);
+    }
+
+  void AddCriterion(StopCriterion* criterion) {
+    criteria_->push_back(std::unique_ptr<StopCriterion>(criterion));
+  }
+
+  bool HasCriteria() const {
+    return !criteria_->empty();
   }
 
   virtual void Init() {
-    nbr_solutions_with_no_better_obj_ = 0;
     limit_reached_ = false;
-    if (minimize_) {
-      best_result_ = kint64max;
-    } else {
-      best_result_ = kint64min;
+    for (const std::unique_ptr<StopCriterion>& criterion: *criteria_) {
+      criterion->Init();
     }
   }
 
   //  Returns true if limit is reached, false otherwise.
   virtual bool Check() {
-    if (!first_solution_ && (nbr_solutions_with_no_better_obj_ > solution_nbr_tolerance_ && solution_nbr_tolerance_ > 0 || 1e-6 * (base::GetCurrentTimeNanos() - start_time_) > time_out_ && initial_time_out_ > 0)) {
-      limit_reached_ = true;
+    if (limit_reached_) return true;
+    const double now = 1e-6 * (base::GetCurrentTimeNanos() - start_time_);
+    for (const std::unique_ptr<StopCriterion>& criterion: *criteria_) {
+      if (criterion->Check(now)) {
+        std::cout << "Stop on " << criterion->Name() << " after " << now << " ms" << std::endl;
+        limit_reached_ = true;
+        break;
+      }
     }
-    //VLOG(2) << "NoImprovementLimit's limit reached? " << limit_reached_;
-
     return limit_reached_;
   }
 
   virtual bool AtSolution() {
-
     prototype_->Store();
-
-    const IntVar* objective = prototype_->Objective();
-    if (minimize_ && objective->Min() * 1.01 < best_result_) {
-      if (first_solution_) {
-        first_solution_ = false;
-      }
-      best_result_ = objective->Min();
-      nbr_solutions_with_no_better_obj_ = 0;
-      if (initial_time_out_ > 0) time_out_ = std::max(initial_time_out_ - 1e-6 * (base::GetCurrentTimeNanos() - start_time_), time_out_coef_ * 1e-6 * (base::GetCurrentTimeNanos() - start_time_));
-    } else if (!minimize_ && objective->Max() * 0.99 > best_result_) {
-      if (first_solution_) {
-        first_solution_ = false;
-      }
-      best_result_ = objective->Max();
-      nbr_solutions_with_no_better_obj_ = 0;
-      if (initial_time_out_ > 0) time_out_ = std::max(initial_time_out_ - 1e-6 * (base::GetCurrentTimeNanos() - start_time_), time_out_coef_ * 1e-6 * (base::GetCurrentTimeNanos() - start_time_));
+    const double now = 1e-6 * (base::GetCurrentTimeNanos() - start_time_);
+    const int64 cost = prototype_->Objective()->Min();
+    for (const std::unique_ptr<StopCriterion>& criterion: *criteria_) {
+      criterion->AtSolution(cost, now);
     }
-
-    ++nbr_solutions_with_no_better_obj_;
-
     return true;
   }
 
   virtual void Copy(const SearchLimit* const limit) {
-    const NoImprovementLimit* const copy_limit =
-    reinterpret_cast<const NoImprovementLimit* const>(limit);
+    const StoppingPolicy* const copy_limit =
+    reinterpret_cast<const StoppingPolicy* const>(limit);
 
-    best_result_ = copy_limit->best_result_;
-    solution_nbr_tolerance_ = copy_limit->solution_nbr_tolerance_;
-    minimize_ = copy_limit->minimize_;
-    initial_time_out_= copy_limit->initial_time_out_;
-    time_out_ = copy_limit->time_out_;
-    limit_reached_ = copy_limit->limit_reached_;
-    first_solution_ = copy_limit->first_solution_;
-    time_out_coef_ = copy_limit->time_out_coef_;
+    criteria_ = copy_limit->criteria_;
     start_time_ = copy_limit->start_time_;
-    nbr_solutions_with_no_better_obj_ = copy_limit->nbr_solutions_with_no_better_obj_;
+    limit_reached_ = copy_limit->limit_reached_;
   }
 
   // Allocates a clone of the limit
   virtual SearchLimit* MakeClone() const {
     // we don't to copy the variables
-    return solver_->RevAlloc(new NoImprovementLimit(solver_, prototype_->Objective(), solution_nbr_tolerance_, time_out_, time_out_coef_, minimize_));
+    return solver_->RevAlloc(new StoppingPolicy(solver_, prototype_->Objective(), criteria_));
   }
 
   virtual std::string DebugString() const {
-    return StringPrintf("NoImprovementLimit(crossed = %i)", limit_reached_);
+    return StringPrintf("StoppingPolicy(crossed = %i)", limit_reached_);
   }
 
   private:
     Solver * const solver_;
-    int64 best_result_;
+    std::unique_ptr<Assignment> prototype_;
+    std::shared_ptr<std::vector<std::unique_ptr<StopCriterion>>> criteria_;
     double start_time_;
-    int64 solution_nbr_tolerance_;
-    bool minimize_;
     bool limit_reached_;
-    bool first_solution_;
-    double initial_time_out_;
-    double time_out_;
-    int64 time_out_coef_;
-    int64 nbr_solutions_with_no_better_obj_;
-    std::unique_ptr<Assignment> prototype_;
 };
 
 } // namespace
 
 
-NoImprovementLimit * MakeNoImprovementLimit(Solver * const solver, IntVar * const objective_var, const int64 solution_nbr_tolerance, const double time_out, const int64 time_out_coef, const bool minimize = true) {
-  return solver->RevAlloc(new NoImprovementLimit(solver, objective_var, solution_nbr_tolerance, time_out, time_out_coef, minimize));
+StoppingPolicy * MakeStoppingPolicy(Solver * const solver, IntVar * const objective_var) {
+  return solver->RevAlloc(new StoppingPolicy(solver, objective_var, std::make_shared<std::vector<std::unique_ptr<StopCriterion>>>()));
+}
+
+//  Results written on stdout in pipe mode are each prefixed by their size as
+//  a varint, a size of 0 ends the stream
+bool WriteResultFrame(const ortools_result::Result* result) {
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  google::protobuf::io::FileOutputStream stream(1);
+  {
+    google::protobuf::io::CodedOutputStream output(&stream);
+    if (result != NULL) {
+      output.WriteVarint32(result->ByteSize());
+      result->SerializeWithCachedSizes(&output);
+    } else {
+      output.WriteVarint32(0);
+    }
+    if (output.HadError()) return false;
+  }
+  return stream.Flush();
+}
+
+//  Writes the result to a temporary file renamed over the given one, so a
+//  reader polling the file never sees a partial result. The temporary file
+//  sits next to it, named after the process and the thread so concurrent
+//  writers never share one. The file "-" is stdout, where results are
+//  framed.
+bool WriteResultFile(const ortools_result::Result& result, const std::string& filename) {
+  if (filename == "-") {
+    if (WriteResultFrame(&result)) return true;
+    std::cout << "Failed to write result." << std::endl;
+    return false;
+  }
+  const std::string temporary = filename + ".tmp." + std::to_string(getpid()) + "." +
+    std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::fstream output(temporary, std::ios::out | std::ios::trunc | std::ios::binary);
+  const bool serialized = result.SerializeToOstream(&output);
+  output.close();
+  if (!serialized || output.fail() || rename(temporary.c_str(), filename.c_str()) != 0) {
+    std::cout << "Failed to write result." << std::endl;
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
 }
 
+//  Best solution found by concurrent searches. Results are only written when
+//  they improve the incumbent, under lock, so the output file always holds
+//  the best known solution.
+class SharedIncumbent {
+  public:
+    SharedIncumbent() : best_cost_(kint64max), worker_(-1) {}
+
+    int Worker() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return worker_;
+    }
+
+    ortools_result::Result Result() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return result_;
+    }
+
+    //  Returns false if the result is worse than the incumbent, an equal
+    //  cost replaces it to keep the most complete result
+    bool Publish(int64 cost, const ortools_result::Result& result, int worker, const std::string& filename) {
+      if (cost > best_cost_.load()) return false;
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cost > best_cost_.load()) return false;
+      best_cost_ = cost;
+      worker_ = worker;
+      result_ = result;
+      if (!filename.empty()) WriteResultFile(result_, filename);
+      return true;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::atomic<int64> best_cost_;
+    int worker_;
+    ortools_result::Result result_;
+};
+
+//  Writes the intermediate results off the search thread. The search reads
+//  its routes into the pending snapshot under lock and the writer thread
+//  swaps it with the one it writes, so a snapshot handed over while another
+//  one is written replaces the one still waiting. Writes are at least the
+//  given interval apart, whatever the rate of solutions.
+class IntermediateWriter {
+  public:
+    IntermediateWriter(const RouteExtractor &extractor, const std::string& filename, SharedIncumbent* incumbent, int worker, int64 interval_ms) :
+    extractor_(extractor), filename_(filename), incumbent_(incumbent), worker_(worker), interval_(std::chrono::milliseconds(interval_ms)),
+    waiting_(false), stop_(false) {
+      thread_ = std::thread([this]() { Run(); });
+    }
+
+    ~IntermediateWriter() {
+      Stop();
+    }
+
+    //  Called at a solution of the search
+    void Submit(int64 objective, int64 iterations, double time) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        extractor_.Capture(NULL, &pending_);
+        pending_.objective = objective;
+        pending_.iterations = iterations;
+        pending_.time = time;
+        waiting_ = true;
+      }
+      ready_.notify_one();
+    }
+
+    //  Writes the snapshot still waiting, if any, and waits for the thread
+    void Stop() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      ready_.notify_one();
+      if (thread_.joinable()) thread_.join();
+    }
+
+  private:
+    void Run() {
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          ready_.wait(lock, [this]() { return waiting_ || stop_; });
+          // Snapshots handed over until the interval is over replace it
+          ready_.wait_until(lock, last_write_ + interval_, [this]() { return stop_; });
+          if (!waiting_) return;
+          std::swap(pending_, writing_);
+          waiting_ = false;
+        }
+        extractor_.BuildResult(writing_, &result_);
+        Write();
+        last_write_ = std::chrono::steady_clock::now();
+      }
+    }
+
+    void Write() {
+      if (incumbent_ != NULL) {
+        if (incumbent_->Publish(writing_.objective, result_, worker_, filename_))
+          std::cout << "Worker : " << worker_ << " Iteration : " << writing_.iterations << " Cost : " << result_.cost() << " Time : " << writing_.time << std::endl;
+        return;
+      }
+      if (!WriteResultFile(result_, filename_)) return;
+      std::cout << "Iteration : " << writing_.iterations << " Cost : " << result_.cost() << " Time : " << writing_.time << std::endl;
+    }
+
+    const RouteExtractor &extractor_;
+    const std::string filename_;
+    SharedIncumbent* const incumbent_;
+    const int worker_;
+    const std::chrono::steady_clock::duration interval_;
+    std::chrono::steady_clock::time_point last_write_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    RouteSnapshot pending_;
+    RouteSnapshot writing_;
+    bool waiting_;
+    bool stop_;
+    ortools_result::Result result_;
+    std::thread thread_;
+};
+
 namespace {
 
 //  Don't use this class within a MakeLimit factory method!
 class LoggerMonitor : public SearchLimit {
   public:
-    LoggerMonitor(const TSPTWDataDT &data, RoutingModel * routing, int64 min_start, int64 size_matrix, std::vector<IntVar*> breaks, bool debug, bool intermediate, ortools_result::Result* result, std::string filename, const bool minimize = true) :
+    LoggerMonitor(const TSPTWDataDT &data, RoutingModel * routing, int64 min_start, int64 size_matrix, std::vector<IntVar*> breaks, bool debug, IntermediateWriter* writer, const bool minimize = true) :
     data_(data),
     routing_(routing),
     SearchLimit(routing->solver()),
@@ -160,9 +478,7 @@ class LoggerMonitor : public SearchLimit {
     size_matrix_(size_matrix),
     breaks_(breaks),
     debug_(debug),
-    intermediate_(intermediate),
-    result_(result),
-    filename_(filename),
+    writer_(writer),
     minimize_(minimize) {
         if (minimize_) {
           best_result_ = kint64max;
@@ -200,112 +516,11 @@ class LoggerMonitor : public SearchLimit {
     const IntVar* objective = prototype_->Objective();
     if (minimize_ && objective->Min() * 1.01 < best_result_) {
       best_result_ = objective->Min();
-      if (intermediate_) {
-        if (result_->routes_size() > 0) result_->clear_routes();
-        result_->set_cost((int64)(best_result_ / 1000.0));
-        result_->set_iterations(iteration_counter_);
-        int current_break = 0;
-
-        for (int route_nbr = 0; route_nbr < routing_->vehicles(); route_nbr++) {
-          int route_break = 0;
-          ortools_result::Route* route = result_->add_routes();
-          int previous_index = -1;
-          for (int64 index = routing_->Start(route_nbr); !routing_->IsEnd(index); index = routing_->NextVar(index)->Value()) {
-            ortools_result::Activity* activity = route->add_activities();
-            RoutingModel::NodeIndex nodeIndex = routing_->IndexToNode(index);
-            activity->set_index(data_.MatrixIndex(nodeIndex));
-            activity->set_start_time(routing_->GetMutableDimension("time")->CumulVar(index)->Min());
-            if (previous_index == -1) activity->set_type("start");
-            else activity->set_type("service");
-
-            for (int64 q = 0 ; q < data_.Quantities(RoutingModel::NodeIndex(0)).size(); ++q) {
-              double exchange = routing_->GetMutableDimension("quantity" + std::to_string(q))->CumulVar(index)->Min();
-              activity->add_quantities(exchange/1000.);
-            }
-
-            if (current_break < data_.Rests().size() && data_.Vehicles().at(route_nbr)->break_size > 0 && breaks_[current_break]->Value() == index) {
-              ortools_result::Activity* break_activity = route->add_activities();
-              break_activity->set_index(route_break);
-              break_activity->set_type("break");
-              current_break++;
-              route_break++;
-            }
-            previous_index = index;
-          }
-          if (current_break < data_.Rests().size() && data_.Vehicles().at(route_nbr)->break_size > 0 && breaks_[current_break]->Value() == routing_->End(route_nbr)) {
-              ortools_result::Activity* break_activity = route->add_activities();
-              break_activity->set_index(route_break);
-              break_activity->set_type("break");
-              current_break++;
-              route_break++;
-          }
-          ortools_result::Activity* end_activity = route->add_activities();
-          RoutingModel::NodeIndex nodeIndex = routing_->IndexToNode(routing_->End(route_nbr));
-          end_activity->set_index(data_.MatrixIndex(nodeIndex));
-          end_activity->set_start_time(routing_->GetMutableDimension("time")->CumulVar(routing_->End(route_nbr))->Min());
-          end_activity->set_type("end");
-        }
-        std::fstream output(filename_, std::ios::out | std::ios::trunc | std::ios::binary);
-        if (!result_->SerializeToOstream(&output)) {
-          std::cout << "Failed to write result." << std::endl;
-          return false;
-        }
-        output.close();
-        std::cout << "Iteration : " << iteration_counter_ << " Cost : " << (int64)(best_result_ / 1000.0) << " Time : " << 1e-9 * (base::GetCurrentTimeNanos() - start_time_) << std::endl;
-      }
+      if (writer_ != NULL) writer_->Submit(best_result_, iteration_counter_, 1e-9 * (base::GetCurrentTimeNanos() - start_time_));
       new_best = true;
     } else if (!minimize_ && objective->Max() * 0.99 > best_result_) {
       best_result_ = objective->Max();
-      if (intermediate_) {
-        if (result_->routes_size() > 0) result_->clear_routes();
-        int current_break = 0;
-        for (int route_nbr = 0; route_nbr < routing_->vehicles(); route_nbr++) {
-          int route_break = 0;
-          ortools_result::Route* route = result_->add_routes();
-          int previous_index = -1;
-          for (int64 index = routing_->Start(route_nbr); !routing_->IsEnd(index); index = routing_->NextVar(index)->Value()) {
-            ortools_result::Activity* activity = route->add_activities();
-            RoutingModel::NodeIndex nodeIndex = routing_->IndexToNode(index);
-            activity->set_index(data_.MatrixIndex(nodeIndex));
-            activity->set_start_time(routing_->GetMutableDimension("time")->CumulVar(index)->Min());
-            if (previous_index == -1) activity->set_type("start");
-            else activity->set_type("service");
-
-            for (int64 q = 0 ; q < data_.Quantities(RoutingModel::NodeIndex(0)).size(); ++q) {
-              double exchange = routing_->GetMutableDimension("quantity" + std::to_string(q))->CumulVar(index)->Min();
-              activity->add_quantities(exchange/1000.);
-            }
-
-            if (current_break < data_.Rests().size() && data_.Vehicles().at(route_nbr)->break_size > 0 && breaks_[current_break]->Value() == index) {
-              ortools_result::Activity* break_activity = route->add_activities();
-              break_activity->set_index(route_break);
-              break_activity->set_type("break");
-              current_break++;
-              route_break++;
-            }
-            previous_index = index;
-          }
-          if (current_break < data_.Rests().size() && data_.Vehicles().at(route_nbr)->break_size > 0 && breaks_[current_break]->Value() == routing_->End(route_nbr)) {
-              ortools_result::Activity* break_activity = route->add_activities();
-              break_activity->set_index(route_break);
-              break_activity->set_type("break");
-              current_break++;
-              route_break++;
-          }
-          ortools_result::Activity* end_activity = route->add_activities();
-          RoutingModel::NodeIndex nodeIndex = routing_->IndexToNode(routing_->End(route_nbr));
-          end_activity->set_index(data_.MatrixIndex(nodeIndex));
-          end_activity->set_start_time(routing_->GetMutableDimension("time")->CumulVar(routing_->End(route_nbr))->Min());
-          end_activity->set_type("end");
-        }
-        std::fstream output(filename_, std::ios::out | std::ios::trunc | std::ios::binary);
-        if (!result_->SerializeToOstream(&output)) {
-          std::cout << "Failed to write result." << std::endl;
-          return false;
-        }
-        output.close();
-        std::cout << "Iteration : " << iteration_counter_ << " Cost : " << (int64)(best_result_ / 1000.0) << " Time : " << 1e-9 * (base::GetCurrentTimeNanos() - start_time_) << std::endl;
-      }
+      if (writer_ != NULL) writer_->Submit(best_result_, iteration_counter_, 1e-9 * (base::GetCurrentTimeNanos() - start_time_));
       new_best = true;
     }
 
@@ -342,7 +557,7 @@ class LoggerMonitor : public SearchLimit {
     start_time_ = copy_limit->start_time_;
     size_matrix_ = copy_limit->size_matrix_;
     breaks_ = copy_limit->breaks_;
-    result_ = copy_limit->result_;
+    writer_ = copy_limit->writer_;
     minimize_ = copy_limit->minimize_;
     limit_reached_ = copy_limit->limit_reached_;
   }
@@ -350,7 +565,7 @@ class LoggerMonitor : public SearchLimit {
   // Allocates a clone of the limit
   virtual SearchLimit* MakeClone() const {
     // we don't to copy the variables
-    return solver_->RevAlloc(new LoggerMonitor(data_, routing_, min_start_, size_matrix_, breaks_, debug_, intermediate_, result_, filename_, minimize_));
+    return solver_->RevAlloc(new LoggerMonitor(data_, routing_, min_start_, size_matrix_, breaks_, debug_, writer_, minimize_));
   }
 
   virtual std::string DebugString() const {
@@ -377,18 +592,16 @@ class LoggerMonitor : public SearchLimit {
     bool minimize_;
     bool limit_reached_;
     bool debug_;
-    bool intermediate_;
     int64 pow_;
     int64 iteration_counter_;
     std::unique_ptr<Assignment> prototype_;
-    std::string filename_;
-    ortools_result::Result* result_;
+    IntermediateWriter* writer_;
 };
 
 } // namespace
 
-LoggerMonitor * MakeLoggerMonitor(const TSPTWDataDT &data, RoutingModel * routing, int64 min_start, int64 size_matrix, std::vector<IntVar*> breaks, bool debug, bool intermediate, ortools_result::Result* result, std::string filename, const bool minimize = true) {
-  return routing->solver()->RevAlloc(new LoggerMonitor(data, routing, min_start, size_matrix, breaks, debug, intermediate, result, filename, minimize));
+LoggerMonitor * MakeLoggerMonitor(const TSPTWDataDT &data, RoutingModel * routing, int64 min_start, int64 size_matrix, std::vector<IntVar*> breaks, bool debug, IntermediateWriter* writer = NULL, const bool minimize = true) {
+  return routing->solver()->RevAlloc(new LoggerMonitor(data, routing, min_start, size_matrix, breaks, debug, writer, minimize));
 }
 }  //  namespace operations_research
 
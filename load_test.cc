@@ -0,0 +1,118 @@
+//  Loads a small problem with sequence contraction and co-located
+//  aggregation enabled and checks the nodes built from it, with and
+//  without capacity units.
+
+#include <iostream>
+#include <memory>
+
+#include "ortools/base/commandlineflags.h"
+#include "ortools/base/logging.h"
+
+#include "ortools_vrp.pb.h"
+#include "tsptw_data_dt.h"
+
+namespace operations_research {
+
+//  Depot at 0, services at 1, 2 and 3. s1 and s2 are linked by a sequence,
+//  s3 and s4 share location 3 and s5 stands alone at location 1. With
+//  quantities, service sN loads N of a first unit and 1 of a counting one.
+ortools_vrp::Problem ContractionProblem(bool quantities) {
+  ortools_vrp::Problem problem;
+
+  ortools_vrp::Matrix* matrix = problem.add_matrices();
+  const int size = 4;
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < size; ++j) {
+      matrix->add_time(i == j ? 0 : 10);
+      matrix->add_distance(i == j ? 0 : 100);
+    }
+  }
+
+  ortools_vrp::Vehicle* vehicle = problem.add_vehicles();
+  vehicle->set_id("v0");
+  vehicle->set_matrix_index(0);
+  vehicle->set_start_index(0);
+  vehicle->set_end_index(0);
+  vehicle->mutable_time_window()->set_start(0);
+  vehicle->mutable_time_window()->set_end(10000);
+  vehicle->set_cost_time_multiplier(1);
+  if (quantities) {
+    vehicle->add_capacities()->set_limit(100);
+    ortools_vrp::Capacity* counting = vehicle->add_capacities();
+    counting->set_limit(10);
+    counting->set_counting(true);
+  }
+
+  const int locations[] = {1, 2, 3, 3, 1};
+  for (int s = 0; s < 5; ++s) {
+    ortools_vrp::Service* service = problem.add_services();
+    service->set_id("s" + std::to_string(s + 1));
+    service->set_matrix_index(locations[s]);
+    service->set_duration(5);
+    if (quantities) {
+      service->add_quantities(s + 1);
+      service->add_quantities(1);
+      service->add_setup_quantities(0);
+      service->add_setup_quantities(0);
+    }
+  }
+
+  ortools_vrp::Relation* relation = problem.add_relations();
+  relation->set_type("sequence");
+  relation->add_linked_ids("s1");
+  relation->add_linked_ids("s2");
+
+  return problem;
+}
+
+void TestContraction() {
+  FLAGS_sequence_contraction = true;
+  FLAGS_colocated_aggregation = true;
+
+  const TSPTWDataDT data(ContractionProblem(false));
+
+  // One node for the sequence, one for s3 and s4, one for s5, start and end
+  CHECK_EQ(data.Size(), 5);
+  CHECK_EQ(data.SequenceMembers(RoutingModel::NodeIndex(0)).size(), 2);
+  CHECK_EQ(data.SequenceIds(RoutingModel::NodeIndex(0))[1], "s2");
+  // Inner travel between locations 1 and 2 follows the s1 duration
+  CHECK_EQ(data.SequenceOffsets(RoutingModel::NodeIndex(0))[1], 15);
+  CHECK_EQ(data.SequenceMembers(RoutingModel::NodeIndex(1)).size(), 2);
+  CHECK_EQ(data.SequenceIds(RoutingModel::NodeIndex(1))[1], "s4");
+  CHECK(data.SequenceMembers(RoutingModel::NodeIndex(2)).empty());
+  CHECK_EQ(data.ServiceId(RoutingModel::NodeIndex(2)), "s5");
+}
+
+//  Contracted and aggregated nodes carry the sum of their members and
+//  answer the quantity callbacks of every unit, counting ones included
+void TestContractionQuantities() {
+  FLAGS_sequence_contraction = true;
+  FLAGS_colocated_aggregation = true;
+
+  const TSPTWDataDT data(ContractionProblem(true));
+  CHECK_EQ(data.Size(), 5);
+
+  const TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(0);
+  const std::vector<std::pair<RoutingModel::NodeIndex, RoutingModel::NodeIndex>> start_ends(1, std::make_pair(vehicle->start, vehicle->stop));
+  RoutingModel routing(data.Size(), 1, start_ends);
+  std::unique_ptr<ResultCallback1<int64, RoutingModel::NodeIndex>> node_to_index(NewPermanentCallback(&routing, &RoutingModel::NodeToIndex));
+
+  const RoutingModel::NodeIndex sequence(0);
+  const RoutingModel::NodeIndex aggregate(1);
+  CHECK_EQ(data.Quantities(sequence).size(), 2);
+  CHECK_EQ(data.Quantity(node_to_index.get(), 0, sequence, vehicle->stop), 3);
+  CHECK_EQ(data.Quantity(node_to_index.get(), 1, sequence, vehicle->stop), 2);
+  CHECK_EQ(data.Quantity(node_to_index.get(), 0, aggregate, sequence), 7);
+  CHECK_EQ(data.Quantity(node_to_index.get(), 1, aggregate, sequence), 2);
+  CHECK_EQ(data.RefillQuantities(aggregate).size(), 2);
+}
+
+}  //  namespace operations_research
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  operations_research::TestContraction();
+  operations_research::TestContractionQuantities();
+  std::cout << "load_test: OK" << std::endl;
+  return 0;
+}
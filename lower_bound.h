@@ -0,0 +1,180 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_LOWER_BOUND_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_LOWER_BOUND_H
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ortools/base/timer.h"
+#include "ortools/graph/ebert_graph.h"
+#include "ortools/graph/linear_assignment.h"
+
+#include "tsptw_data_dt.h"
+
+namespace operations_research {
+
+namespace {
+
+//  Vehicles whose arcs between services cost the same
+bool SameServiceArcs(const TSPTWDataDT::Vehicle* a, const TSPTWDataDT::Vehicle* b) {
+  return a->problem_matrix_index == b->problem_matrix_index && a->value_matrix_index == b->value_matrix_index &&
+    a->cost_distance_multiplier == b->cost_distance_multiplier && a->cost_time_multiplier == b->cost_time_multiplier &&
+    a->cost_waiting_time_multiplier == b->cost_waiting_time_multiplier && a->cost_value_multiplier == b->cost_value_multiplier &&
+    a->max_ride_time_ == b->max_ride_time_ && a->max_ride_distance_ == b->max_ride_distance_ &&
+    std::equal(a->vehicle_indices.begin(), a->vehicle_indices.end() - 2, b->vehicle_indices.begin()) &&
+    std::equal(a->vehicle_out_indices.begin(), a->vehicle_out_indices.end() - 2, b->vehicle_out_indices.begin());
+}
+
+//  Cost of an arc for a vehicle as counted by the span costs of the time,
+//  time without wait, distance and value dimensions, waiting excluded
+int64 ArcCost(const TSPTWDataDT::Vehicle* vehicle, RoutingModel::NodeIndex from, RoutingModel::NodeIndex to) {
+  const int64 time_cost = std::max(vehicle->cost_waiting_time_multiplier, (int64)0) +
+    std::max(vehicle->cost_time_multiplier - vehicle->cost_waiting_time_multiplier, (int64)0);
+  return time_cost * vehicle->TimePlusServiceTime(from, to) +
+    vehicle->cost_distance_multiplier * vehicle->DistancePlusServiceDistance(from, to) +
+    vehicle->cost_value_multiplier * vehicle->ValuePlusServiceValue(from, to);
+}
+
+} // namespace
+
+//  Lower bound of the objective from an assignment relaxation: each service
+//  is either dropped for its penalty, or entered and left through exactly
+//  one arc. An arc costs as much as with the cheapest vehicle allowed at
+//  both ends and a vehicle fixed cost comes with its first arc. Waiting,
+//  lateness and overload costs are left out. Above max_nodes, only the
+//  cheapest arc entering or leaving each service is counted. Penalties of
+//  -1 are mandatory services. Returns kint64min if a cost is negative.
+int64 ObjectiveLowerBound(const TSPTWDataDT& data, const std::vector<int64>& penalties, int32 max_nodes) {
+  const std::vector<TSPTWDataDT::Vehicle*> vehicles = data.Vehicles();
+  const int size_vehicles = vehicles.size();
+  const int size_services = data.Size() - 2;
+  for (const TSPTWDataDT::Vehicle* vehicle: vehicles) {
+    if (vehicle->cost_fixed < 0 || vehicle->cost_distance_multiplier < 0 || vehicle->cost_value_multiplier < 0)
+      return kint64min;
+  }
+
+  std::vector<int> representatives;
+  std::vector<int> vehicle_class(size_vehicles);
+  for (int v = 0; v < size_vehicles; ++v) {
+    vehicle_class[v] = representatives.size();
+    for (int c = 0; c < representatives.size(); ++c) {
+      if (SameServiceArcs(vehicles[representatives[c]], vehicles[v])) {
+        vehicle_class[v] = c;
+        break;
+      }
+    }
+    if (vehicle_class[v] == representatives.size()) representatives.push_back(v);
+  }
+  const int size_classes = representatives.size();
+
+  // A class is allowed at a service if one of its vehicles is
+  std::vector<std::vector<bool>> allowed(size_services, std::vector<bool>(size_classes, false));
+  std::vector<std::vector<bool>> vehicle_allowed(size_services, std::vector<bool>(size_vehicles, false));
+  for (RoutingModel::NodeIndex i(0); i < size_services; ++i) {
+    const std::vector<int64> sticky_vehicle = data.VehicleIndices(i);
+    for (int v = 0; v < size_vehicles; ++v) {
+      bool sticked = sticky_vehicle.size() == 0;
+      for (int64 sticky : sticky_vehicle) {
+        if (v == sticky || sticky == -1) sticked = true;
+      }
+      vehicle_allowed[i.value()][v] = sticked;
+      if (sticked) allowed[i.value()][vehicle_class[v]] = true;
+    }
+  }
+
+  const int64 none = kint64max;
+  auto service_arc = [&](int i, int j) {
+    int64 cost = none;
+    for (int c = 0; c < size_classes; ++c) {
+      if (allowed[i][c] && allowed[j][c])
+        cost = std::min(cost, ArcCost(vehicles[representatives[c]], RoutingModel::NodeIndex(i), RoutingModel::NodeIndex(j)));
+    }
+    return cost;
+  };
+  auto start_arc = [&](int v, int j) {
+    if (!vehicle_allowed[j][v]) return none;
+    return vehicles[v]->cost_fixed + ArcCost(vehicles[v], vehicles[v]->Start(), RoutingModel::NodeIndex(j));
+  };
+  auto end_arc = [&](int i, int v) {
+    if (!vehicle_allowed[i][v]) return none;
+    return ArcCost(vehicles[v], RoutingModel::NodeIndex(i), vehicles[v]->Stop());
+  };
+
+  if (size_services + size_vehicles > max_nodes) {
+    std::vector<int64> entering(size_services, none);
+    std::vector<int64> leaving(size_services, none);
+    for (int i = 0; i < size_services; ++i) {
+      if (penalties[i] >= 0) entering[i] = leaving[i] = penalties[i];
+    }
+    for (int i = 0; i < size_services; ++i) {
+      for (int j = 0; j < size_services; ++j) {
+        if (i == j) continue;
+        const int64 cost = service_arc(i, j);
+        leaving[i] = std::min(leaving[i], cost);
+        entering[j] = std::min(entering[j], cost);
+      }
+      for (int v = 0; v < size_vehicles; ++v) {
+        entering[i] = std::min(entering[i], start_arc(v, i));
+        leaving[i] = std::min(leaving[i], end_arc(i, v));
+      }
+    }
+    const int64 cap = kint64max / (size_services + 1);
+    int64 entering_bound = 0;
+    int64 leaving_bound = 0;
+    for (int i = 0; i < size_services; ++i) {
+      if (entering[i] != none) entering_bound += std::min(entering[i], cap);
+      if (leaving[i] != none) leaving_bound += std::min(leaving[i], cap);
+    }
+    return std::max(entering_bound, leaving_bound);
+  }
+
+  // Left nodes are services then vehicle starts, right nodes services then
+  // vehicle ends
+  const int size_nodes = size_services + size_vehicles;
+  const int64 cap = kint64max / (4 * (int64)(size_nodes + 1)) / (size_nodes + 1);
+  ForwardStarGraph graph(2 * size_nodes, size_nodes * size_nodes);
+  std::vector<std::pair<ArcIndex, int64>> costs;
+  auto add_arc = [&](int left, int right, int64 cost) {
+    if (cost == none) return;
+    costs.push_back(std::make_pair(graph.AddArc(left, size_nodes + right), std::min(cost, cap)));
+  };
+  for (int i = 0; i < size_services; ++i) {
+    if (penalties[i] >= 0) add_arc(i, i, penalties[i]);
+    for (int j = 0; j < size_services; ++j) {
+      if (i != j) add_arc(i, j, service_arc(i, j));
+    }
+    for (int v = 0; v < size_vehicles; ++v) {
+      add_arc(i, size_services + v, end_arc(i, v));
+      add_arc(size_services + v, i, start_arc(v, i));
+    }
+  }
+  for (int v = 0; v < size_vehicles; ++v) {
+    add_arc(size_services + v, size_services + v, 0);
+  }
+
+  LinearSumAssignment<ForwardStarGraph> assignment(graph, size_nodes);
+  for (const std::pair<ArcIndex, int64>& arc: costs) {
+    assignment.SetArcCost(arc.first, arc.second);
+  }
+  if (!assignment.ComputeAssignment()) return kint64min;
+  return assignment.GetCost();
+}
+
+//  Computes the lower bound of the data once, on a detached thread which
+//  keeps the data alive. Searches read data.LowerBound() when they need it
+//  and go on without it until then, so none of them waits for the bound.
+void StartObjectiveLowerBound(const std::shared_ptr<const TSPTWDataDT>& data, const std::vector<int64>& penalties, int32 max_nodes) {
+  std::thread([data, penalties, max_nodes]() {
+    const double start_time = base::GetCurrentTimeNanos();
+    const int64 lower_bound = ObjectiveLowerBound(*data, penalties, max_nodes);
+    data->LowerBound()->store(lower_bound);
+    std::cout << "Lower bound : " << (int64)(lower_bound / 1000.0) << " Time : " << 1e-9 * (base::GetCurrentTimeNanos() - start_time) << std::endl;
+  }).detach();
+}
+
+}  //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_LOWER_BOUND_H
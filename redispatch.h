@@ -0,0 +1,201 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_REDISPATCH_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_REDISPATCH_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+
+#include "decomposition.h"
+
+namespace operations_research {
+
+//  Reads a message prefixed by its varint size, false at the end of the
+//  stream. A coded stream per message keeps clear of its total bytes limit.
+bool ReadDelimited(google::protobuf::io::ZeroCopyInputStream* stream, google::protobuf::Message* message) {
+  google::protobuf::io::CodedInputStream input(stream);
+  uint32 size;
+  if (!input.ReadVarint32(&size)) return false;
+  const google::protobuf::io::CodedInputStream::Limit limit = input.PushLimit(size);
+  const bool parsed = message->ParseFromCodedStream(&input) && input.ConsumedEntireMessage();
+  input.PopLimit(limit);
+  return parsed;
+}
+
+//  Cancelled services are removed from the problem, with their relations
+//  and route entries, and new services appended
+void ApplyUpdate(const ortools_vrp::Update& update, ortools_vrp::Problem* problem) {
+  if (update.matrices_size() > 0) problem->mutable_matrices()->CopyFrom(update.matrices());
+
+  const std::set<std::string> cancelled(update.cancelled_ids().begin(), update.cancelled_ids().end());
+  if (!cancelled.empty()) {
+    google::protobuf::RepeatedPtrField<ortools_vrp::Service> services;
+    for (const ortools_vrp::Service& service: problem->services()) {
+      if (cancelled.count(service.id()) == 0) services.Add()->CopyFrom(service);
+    }
+    problem->mutable_services()->Swap(&services);
+
+    google::protobuf::RepeatedPtrField<ortools_vrp::Relation> relations;
+    for (const ortools_vrp::Relation& relation: problem->relations()) {
+      ortools_vrp::Relation kept(relation);
+      kept.clear_linked_ids();
+      for (const std::string& id: relation.linked_ids()) {
+        if (cancelled.count(id) == 0) kept.add_linked_ids(id);
+      }
+      if (kept.linked_ids_size() > 0) relations.Add()->Swap(&kept);
+    }
+    problem->mutable_relations()->Swap(&relations);
+
+    for (ortools_vrp::Route& route: *problem->mutable_routes()) {
+      google::protobuf::RepeatedPtrField<std::string> ids;
+      for (const std::string& id: route.service_ids()) {
+        if (cancelled.count(id) == 0) *ids.Add() = id;
+      }
+      route.mutable_service_ids()->Swap(&ids);
+    }
+  }
+
+  for (const ortools_vrp::Service& service: update.services()) {
+    problem->add_services()->CopyFrom(service);
+  }
+  for (const ortools_vrp::Relation& relation: update.relations()) {
+    problem->add_relations()->CopyFrom(relation);
+  }
+}
+
+//  Services started before the given time are frozen. A vehicle with a
+//  frozen part then starts where it left, once the last one is done, with
+//  what is left of its capacities and duration. Remaining services keep
+//  their place in the routes given to the sub-problem. Remaining services
+//  tied by a relation to a frozen one are pinned to its vehicle, after the
+//  frozen part and in the relation order.
+ortools_vrp::Problem DispatchProblem(const ortools_vrp::Problem& problem, const ortools_result::Result& result, int64 time, std::vector<int>* service_map, std::vector<ortools_result::Route>* frozen) {
+  std::map<std::string, int> indices;
+  for (int s = 0; s < problem.services_size(); ++s) {
+    indices[problem.services(s).id()] = s;
+  }
+
+  std::map<int, ortools_vrp::Vehicle> replaced;
+  std::vector<bool> done(problem.services_size(), false);
+  std::vector<int> done_vehicle(problem.services_size(), -1);
+  std::vector<std::vector<std::string>> remaining(problem.vehicles_size());
+  frozen->assign(problem.vehicles_size(), ortools_result::Route());
+  for (int v = 0; v < problem.vehicles_size() && v < result.routes_size(); ++v) {
+    const ortools_result::Route& route = result.routes(v);
+    ortools_result::Route& prefix = frozen->at(v);
+    prefix.set_vehicle_id(route.vehicle_id());
+    int last = -1;
+    int64 departure = 0;
+    for (const ortools_result::Activity& activity: route.activities()) {
+      if (activity.type() == "start" && activity.start_time() < time) {
+        prefix.add_activities()->CopyFrom(activity);
+        prefix.mutable_activities(0)->set_index(problem.services_size());
+      }
+      if (activity.type() != "service") continue;
+      std::map<std::string, int>::const_iterator it = indices.find(activity.id());
+      if (it == indices.end()) continue;
+      if (activity.start_time() < time && prefix.activities_size() > 0 && remaining[v].empty()) {
+        ortools_result::Activity* started = prefix.add_activities();
+        started->CopyFrom(activity);
+        started->set_index(it->second);
+        done[it->second] = true;
+        done_vehicle[it->second] = v;
+        last = it->second;
+        departure = activity.start_time() + problem.services(last).duration();
+      } else {
+        remaining[v].push_back(activity.id());
+      }
+    }
+    if (last == -1) {
+      prefix.clear_activities();
+      continue;
+    }
+
+    ortools_vrp::Vehicle vehicle(problem.vehicles(v));
+    vehicle.set_start_index(problem.services(last).matrix_index());
+    vehicle.mutable_time_window()->set_start(std::max(vehicle.time_window().start(), departure));
+    vehicle.set_force_start(false);
+    if (vehicle.duration() > 0)
+      vehicle.set_duration(std::max<int64>(vehicle.duration() - (departure - prefix.activities(0).start_time()), 1));
+    for (int q = 0; q < vehicle.capacities_size(); ++q) {
+      if (vehicle.capacities(q).limit() < 0) continue;
+      int64 used = 0;
+      for (const ortools_result::Activity& activity: prefix.activities()) {
+        if (activity.type() == "service" && q < problem.services(activity.index()).quantities_size())
+          used += problem.services(activity.index()).quantities(q);
+      }
+      vehicle.mutable_capacities(q)->set_limit(std::max<int64>(vehicle.capacities(q).limit() - used, 0));
+    }
+    replaced[v] = vehicle;
+  }
+
+  std::vector<int> services;
+  for (int s = 0; s < problem.services_size(); ++s) {
+    if (!done[s]) services.push_back(s);
+  }
+  std::vector<int> vehicles(problem.vehicles_size());
+  std::iota(vehicles.begin(), vehicles.end(), 0);
+  ortools_vrp::Problem sub = SubProblem(problem, services, vehicles, service_map, &replaced);
+  sub.clear_routes();
+  for (int v = 0; v < problem.vehicles_size(); ++v) {
+    ortools_vrp::Route* route = sub.add_routes();
+    route->set_vehicle_id(problem.vehicles(v).id());
+    for (const std::string& id: remaining[v]) route->add_service_ids(id);
+  }
+
+  std::vector<int> sub_indices(problem.services_size(), -1);
+  for (int i = 0; i < service_map->size(); ++i) {
+    sub_indices[service_map->at(i)] = i;
+  }
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    if (relation.type() != "sequence" && relation.type() != "order" && relation.type() != "same_route" && relation.type() != "shipment")
+      continue;
+    int vehicle = -1;
+    std::vector<std::string> pinned;
+    for (const std::string& id: relation.linked_ids()) {
+      std::map<std::string, int>::const_iterator it = indices.find(id);
+      if (it == indices.end()) continue;
+      if (done[it->second]) vehicle = done_vehicle[it->second];
+      else if (sub_indices[it->second] != -1) pinned.push_back(id);
+    }
+    if (vehicle == -1 || pinned.empty()) continue;
+
+    for (const std::string& id: pinned) {
+      ortools_vrp::Service* service = sub.mutable_services(sub_indices[indices[id]]);
+      service->clear_vehicle_indices();
+      service->add_vehicle_indices(vehicle);
+    }
+    if (pinned.size() > 1) {
+      ortools_vrp::Relation* order = sub.add_relations();
+      order->set_type(relation.type() == "shipment" ? "order" : relation.type());
+      for (const std::string& id: pinned) order->add_linked_ids(id);
+    }
+  }
+  return sub;
+}
+
+//  Frozen parts of the routes followed by the routes of the sub-problem.
+//  The sub-problem cost leaves out the frozen parts, the caller evaluates
+//  the merged routes on the whole problem.
+ortools_result::Result MergeDispatch(const ortools_vrp::Problem& problem, const ortools_result::Result& sub_result, const std::vector<int>& service_map, const std::vector<ortools_result::Route>& frozen) {
+  ortools_result::Result result = EmptyResult(problem);
+  std::vector<int> vehicles(problem.vehicles_size());
+  std::iota(vehicles.begin(), vehicles.end(), 0);
+  MergeSubResult(problem, sub_result, service_map, vehicles, &result);
+  for (int v = 0; v < frozen.size(); ++v) {
+    if (frozen[v].activities_size() == 0) continue;
+    ortools_result::Route merged(frozen[v]);
+    for (const ortools_result::Activity& activity: result.routes(v).activities()) {
+      if (activity.type() != "start") merged.add_activities()->CopyFrom(activity);
+    }
+    result.mutable_routes(v)->Swap(&merged);
+  }
+  result.set_iterations(sub_result.iterations());
+  return result;
+}
+
+}  //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_REDISPATCH_H
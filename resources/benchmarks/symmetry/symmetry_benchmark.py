@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+#  Compares the search with and without --vehicle_symmetry_breaking on
+#  generated instances, for a homogeneous and a heterogeneous fleet.
+#  Instances are written in protobuf text format and encoded with protoc,
+#  results are decoded the same way, so no protobuf python module is needed.
+#  The cost over time is sampled from the intermediate results the solver
+#  writes with -intermediate_solutions.
+
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..', '..', '..'))
+
+#  Vehicle classes of each fleet: count, capacity, fixed cost, cost per
+#  second. Vehicles of a class are interchangeable.
+FLEETS = {
+  'homogeneous': [(60, 100, 500, 1)],
+  'heterogeneous': [(20, 60, 300, 1), (20, 100, 500, 1), (20, 160, 800, 2)],
+}
+
+
+def instance(fleet, services, seed):
+  rng = random.Random(seed)
+  points = [(50, 50)] + [(rng.uniform(0, 100), rng.uniform(0, 100)) for _ in range(services)]
+  lines = ['matrices {']
+  for a in points:
+    for b in points:
+      lines.append('  time: %d' % round(10 * ((a[0] - b[0]) ** 2 + (a[1] - b[1]) ** 2) ** 0.5))
+  for a in points:
+    for b in points:
+      lines.append('  distance: %d' % round(100 * ((a[0] - b[0]) ** 2 + (a[1] - b[1]) ** 2) ** 0.5))
+  lines.append('}')
+
+  index = 0
+  for count, capacity, fixed, per_second in FLEETS[fleet]:
+    for _ in range(count):
+      lines += [
+        'vehicles {',
+        '  id: "v%d"' % index,
+        '  capacities { limit: %d }' % capacity,
+        '  time_window { start: 0 end: 28800 }',
+        '  cost_fixed: %d' % fixed,
+        '  cost_time_multiplier: %d' % per_second,
+        '  matrix_index: 0',
+        '  start_index: 0',
+        '  end_index: 0',
+        '}',
+      ]
+      index += 1
+
+  for s in range(services):
+    start = rng.randrange(0, 25200, 300)
+    lines += [
+      'services {',
+      '  id: "s%d"' % s,
+      '  matrix_index: %d' % (s + 1),
+      '  duration: 300',
+      '  quantities: %d' % rng.randint(1, 20),
+      '  time_windows { start: %d end: %d }' % (start, start + rng.choice([1800, 3600, 7200])),
+      '}',
+    ]
+  return '\n'.join(lines) + '\n'
+
+
+def encode(text, path, protoc):
+  with open(path, 'wb') as output:
+    subprocess.run([protoc, '-I', ROOT, '--encode=ortools_vrp.Problem', os.path.join(ROOT, 'ortools_vrp.proto')],
+                   input=text.encode(), stdout=output, check=True)
+
+
+def decode(path, protoc):
+  with open(path, 'rb') as result:
+    return subprocess.run([protoc, '-I', ROOT, '--decode=ortools_result.Result', os.path.join(ROOT, 'ortools_result.proto')],
+                          stdin=result, stdout=subprocess.PIPE, check=True).stdout.decode()
+
+
+def used_vehicles(path, protoc):
+  text = decode(path, protoc)
+  return sum(1 for route in text.split('routes {')[1:] if 'type: "service"' in route)
+
+
+#  Cost of the result file, None until the first one is written. The solver
+#  renames complete files into place, so a file read is never partial.
+def result_cost(path, protoc):
+  if not os.path.exists(path):
+    return None
+  cost = re.search(r'^cost: (-?\d+)', decode(path, protoc), re.MULTILINE)
+  return int(cost.group(1)) if cost else 0
+
+
+#  Runs the solver and reads its result file every interval, so each sample
+#  holds the best cost known at that time. Returns the iterations, final
+#  cost and vehicles used, or None, and the (seconds, cost) samples.
+def run(binary, problem, solution, symmetry, time_limit, interval, protoc):
+  if os.path.exists(solution):
+    os.remove(solution)
+  with open(solution + '.log', 'w+') as log:
+    process = subprocess.Popen([binary, '-instance_file', problem, '-solution_file', solution,
+                                '-time_limit_in_ms', str(time_limit),
+                                '-intermediate_solutions', '-intermediate_interval_in_ms', str(min(interval, 200)),
+                                '-vehicle_symmetry_breaking=%s' % ('true' if symmetry else 'false')],
+                               stdout=log, stderr=subprocess.STDOUT)
+    start = time.monotonic()
+    samples = []
+    while process.poll() is None:
+      due = start + (len(samples) + 1) * interval / 1000.
+      time.sleep(max(0., due - time.monotonic()))
+      if process.poll() is not None:
+        break
+      samples.append(((len(samples) + 1) * interval / 1000., result_cost(solution, protoc)))
+    log.seek(0)
+    output = log.read()
+  if process.returncode != 0:
+    raise subprocess.CalledProcessError(process.returncode, binary, output)
+  final = re.search(r'Final Iteration : (\d+) Cost : (-?\d+)', output)
+  if final is None:
+    return None, samples
+  samples.append((time.monotonic() - start, int(final.group(2))))
+  return (int(final.group(1)), int(final.group(2)), used_vehicles(solution, protoc)), samples
+
+
+def cost_text(cost):
+  return '-' if cost is None else '%d' % cost
+
+
+def main():
+  parser = argparse.ArgumentParser(description='Vehicle symmetry breaking benchmark')
+  parser.add_argument('--binary', default=os.path.join(ROOT, 'tsp_simple'))
+  parser.add_argument('--protoc', default='protoc')
+  parser.add_argument('--services', type=int, default=300)
+  parser.add_argument('--seeds', type=int, default=5)
+  parser.add_argument('--time_limit_in_ms', type=int, default=30000)
+  parser.add_argument('--sample_interval_in_ms', type=int, default=1000, help='time between two reads of the cost')
+  parser.add_argument('--curves', help='CSV file receiving every cost sample, to plot them')
+  parser.add_argument('--fleets', default=','.join(sorted(FLEETS)))
+  parser.add_argument('--instances_only', action='store_true', help='write the instances and stop')
+  args = parser.parse_args()
+
+  directory = tempfile.mkdtemp(prefix='symmetry_')
+  curves = open(args.curves, 'w') if args.curves else None
+  if curves:
+    curves.write('fleet,seed,symmetry,seconds,cost\n')
+  summary = []
+  for fleet in args.fleets.split(','):
+    for seed in range(args.seeds):
+      problem = os.path.join(directory, '%s_%d.pb' % (fleet, seed))
+      encode(instance(fleet, args.services, seed), problem, args.protoc)
+      if args.instances_only:
+        continue
+      samples = {}
+      for symmetry in (False, True):
+        setting = 'on' if symmetry else 'off'
+        outcome, samples[symmetry] = run(args.binary, problem, problem + '.result', symmetry,
+                                         args.time_limit_in_ms, args.sample_interval_in_ms, args.protoc)
+        if outcome is None:
+          summary.append('| %s | %d | %s | - | no solution | - |' % (fleet, seed, setting))
+        else:
+          summary.append('| %s | %d | %s | %d | %d | %d |' % ((fleet, seed, setting) + outcome))
+        if curves:
+          for seconds, cost in samples[symmetry]:
+            curves.write('%s,%d,%s,%.3f,%s\n' % (fleet, seed, setting, seconds, '' if cost is None else cost))
+
+      print('%s, seed %d' % (fleet, seed))
+      print()
+      print('| Time (s) | Cost off | Cost on |')
+      print('|---|---|---|')
+      for off, on in zip(samples[False], samples[True]):
+        print('| %.1f | %s | %s |' % (off[0], cost_text(off[1]), cost_text(on[1])))
+      print()
+      sys.stdout.flush()
+
+  if summary:
+    print('| Fleet | Seed | Symmetry | Iterations | Cost | Vehicles |')
+    print('|---|---|---|---|---|---|')
+    print('\n'.join(summary))
+  if curves:
+    curves.close()
+  print('Instances in %s' % directory, file=sys.stderr)
+
+
+if __name__ == '__main__':
+  main()
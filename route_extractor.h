@@ -0,0 +1,167 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_ROUTE_EXTRACTOR_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_ROUTE_EXTRACTOR_H
+
+#include <string>
+#include <vector>
+
+#include "ortools/constraint_solver/routing.h"
+
+#include "ortools_result.pb.h"
+#include "tsptw_data_dt.h"
+
+namespace operations_research {
+
+//  Values of a solution needed to write its routes: for each vehicle the
+//  nodes from its start to its end, with their time and quantity cumuls and
+//  the number of breaks taken after each node
+struct RouteSnapshot {
+  RouteSnapshot():
+    objective(0), iterations(0), time(0){}
+  int64 objective;
+  int64 iterations;
+  double time;
+  std::vector<std::vector<int64>> nodes;
+  std::vector<std::vector<int64>> times;
+  //  Cumul of every quantity when leaving each node but the end, node after
+  //  node
+  std::vector<std::vector<int64>> quantities;
+  std::vector<std::vector<int>> breaks;
+};
+
+//  Reads the routes of a solution into a snapshot and turns snapshots into
+//  results. Dimensions are resolved once per model, so reading a route only
+//  costs its length.
+class RouteExtractor {
+  public:
+    RouteExtractor(const TSPTWDataDT &data, RoutingModel &routing, const std::vector<IntVar*> &breaks) :
+    data_(data),
+    routing_(routing),
+    breaks_(breaks),
+    time_(routing.GetMutableDimension("time")),
+    size_rests_(data.Rests().size()),
+    size_quantities_(data.Quantities(RoutingModel::NodeIndex(0)).size()) {
+      for (int64 q = 0; q < size_quantities_; ++q) {
+        const std::string name = "quantity" + std::to_string(q);
+        quantities_.push_back(routing.HasDimension(name) ? routing.GetMutableDimension(name) : NULL);
+      }
+      for (const TSPTWDataDT::Vehicle* vehicle: data.Vehicles()) {
+        vehicle_ids_.push_back(vehicle->id);
+        vehicle_breaks_.push_back(vehicle->break_size > 0);
+      }
+    }
+
+    //  Routes of the given solution, or of the current values of the
+    //  variables when NULL, as at a solution of the search
+    void Capture(const Assignment* solution, RouteSnapshot* snapshot) const {
+      auto value = [solution](IntVar* var) { return solution != NULL ? solution->Value(var) : var->Value(); };
+      auto min = [solution](IntVar* var) { return solution != NULL ? solution->Min(var) : var->Min(); };
+      const int vehicles = routing_.vehicles();
+      snapshot->nodes.resize(vehicles);
+      snapshot->times.resize(vehicles);
+      snapshot->quantities.resize(vehicles);
+      snapshot->breaks.resize(vehicles);
+      int current_break = 0;
+      for (int route_nbr = 0; route_nbr < vehicles; route_nbr++) {
+        snapshot->nodes[route_nbr].clear();
+        snapshot->times[route_nbr].clear();
+        snapshot->quantities[route_nbr].clear();
+        snapshot->breaks[route_nbr].clear();
+        for (int64 index = routing_.Start(route_nbr); ; ) {
+          snapshot->nodes[route_nbr].push_back(routing_.IndexToNode(index).value());
+          snapshot->times[route_nbr].push_back(min(time_->CumulVar(index)));
+          int taken = 0;
+          if (current_break < size_rests_ && vehicle_breaks_[route_nbr] && value(breaks_[current_break]) == index) {
+            current_break++;
+            taken++;
+          }
+          snapshot->breaks[route_nbr].push_back(taken);
+          if (routing_.IsEnd(index)) break;
+          const int64 next = value(routing_.NextVar(index));
+          for (const RoutingDimension* dimension: quantities_) {
+            snapshot->quantities[route_nbr].push_back(dimension != NULL ? min(dimension->CumulVar(next)) : 0);
+          }
+          index = next;
+        }
+      }
+    }
+
+    //  Overwrites the routes and activities already in the result, adding
+    //  or removing the missing or extra ones, so a result reused from one
+    //  solution to the next keeps its messages
+    void BuildResult(const RouteSnapshot& snapshot, ortools_result::Result* result) const {
+      result->set_cost((int64)(snapshot.objective / 1000.0));
+      result->set_iterations(snapshot.iterations);
+      const int vehicles = snapshot.nodes.size();
+      while (result->routes_size() > vehicles) result->mutable_routes()->RemoveLast();
+      for (int route_nbr = 0; route_nbr < vehicles; route_nbr++) {
+        const std::vector<int64>& nodes = snapshot.nodes[route_nbr];
+        ortools_result::Route* route = route_nbr < result->routes_size() ? result->mutable_routes(route_nbr) : result->add_routes();
+        route->set_vehicle_id(vehicle_ids_[route_nbr]);
+        int used = 0;
+        auto next_activity = [route, &used]() {
+          ortools_result::Activity* activity = used < route->activities_size() ? route->mutable_activities(used) : route->add_activities();
+          ++used;
+          activity->Clear();
+          return activity;
+        };
+        int route_break = 0;
+        auto add_breaks = [&next_activity, &route_break](int taken) {
+          for (int b = 0; b < taken; ++b) {
+            ortools_result::Activity* break_activity = next_activity();
+            break_activity->set_index(route_break++);
+            break_activity->set_type("break");
+          }
+        };
+
+        for (int position = 0; position < nodes.size(); ++position) {
+          const RoutingModel::NodeIndex nodeIndex(nodes[position]);
+          // Breaks taken at the end come before it
+          if (position == nodes.size() - 1) {
+            add_breaks(snapshot.breaks[route_nbr][position]);
+            ortools_result::Activity* end_activity = next_activity();
+            end_activity->set_index(data_.MatrixIndex(nodeIndex));
+            end_activity->set_start_time(snapshot.times[route_nbr][position]);
+            end_activity->set_type("end");
+            break;
+          }
+          ortools_result::Activity* activity = next_activity();
+          activity->set_index(data_.MatrixIndex(nodeIndex));
+          activity->set_start_time(snapshot.times[route_nbr][position]);
+          if (position == 0) activity->set_type("start");
+          else {
+            activity->set_type("service");
+            activity->set_id(data_.ServiceId(nodeIndex));
+          }
+          for (int q = 0; q < size_quantities_; ++q) {
+            activity->add_quantities(snapshot.quantities[route_nbr][position * size_quantities_ + q] / 1000.);
+          }
+          // Expand contracted sequence
+          const std::vector<int32>& members = data_.SequenceMembers(nodeIndex);
+          for (int m = 1; m < members.size(); ++m) {
+            ortools_result::Activity* member_activity = next_activity();
+            member_activity->CopyFrom(*activity);
+            member_activity->set_index(members[m]);
+            member_activity->set_id(data_.SequenceIds(nodeIndex)[m]);
+            member_activity->set_start_time(activity->start_time() + data_.SequenceOffsets(nodeIndex)[m]);
+          }
+          add_breaks(snapshot.breaks[route_nbr][position]);
+        }
+        while (route->activities_size() > used) route->mutable_activities()->RemoveLast();
+      }
+    }
+
+  private:
+    const TSPTWDataDT &data_;
+    RoutingModel &routing_;
+    const std::vector<IntVar*> breaks_;
+    RoutingDimension* const time_;
+    const int size_rests_;
+    const int size_quantities_;
+    std::vector<RoutingDimension*> quantities_;
+    std::vector<std::string> vehicle_ids_;
+    std::vector<bool> vehicle_breaks_;
+};
+
+}  //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_ROUTE_EXTRACTOR_H
@@ -16,6 +16,7 @@
 // <http://www.gnu.org/licenses/agpl.html>
 //
 #include <iostream>
+#include <thread>
 
 #include "ortools/base/commandlineflags.h"
 #include "ortools/constraint_solver/routing.h"
@@ -24,7 +25,13 @@
 #include <ortools/base/callback.h>
 
 #include "tsptw_data_dt.h"
+#include "route_extractor.h"
 #include "limits.h"
+#include "decomposition.h"
+#include "redispatch.h"
+#include "lower_bound.h"
+
+#include "google/protobuf/io/zero_copy_stream_impl.h"
 
 #include "ortools/constraint_solver/routing.h"
 #include "ortools/constraint_solver/routing_flags.h"
@@ -33,10 +40,41 @@ DEFINE_int64(time_limit_in_ms, 0, "Time limit in ms, no option means no limit.")
 DEFINE_int64(no_solution_improvement_limit, -1,"Iterations whitout improvement");
 DEFINE_int64(initial_time_out_no_solution_improvement, -1, "Initial time whitout improvement in ms");
 DEFINE_int64(time_out_multiplier, 2, "Multiplier for the nexts time out");
+DEFINE_int64(stop_wall_time_in_ms, 0, "Stop the search after this time, 0 means no limit");
+DEFINE_int64(stop_plateau_in_ms, 0, "Stop when the cost did not improve for this time, 0 means no limit");
+DEFINE_double(stop_plateau_tolerance, 0, "Relative improvement below which the plateau goes on");
+DEFINE_int64(stop_improvement_window_in_ms, 0, "Window over which the improvement rate is measured, 0 means no limit");
+DEFINE_double(stop_min_improvement_rate, 0.001, "Stop when the cost improved by less than this ratio over the window");
+DEFINE_int64(stop_solution_limit, 0, "Stop after this number of solutions, 0 means no limit");
+DEFINE_double(stop_gap, 0, "Stop when the cost is within this ratio of the lower bound, 0 means no limit");
+DEFINE_bool(lower_bound, false, "Compute a lower bound alongside the search and report the gap");
+DEFINE_int32(lower_bound_max_nodes, 2000, "Maximum number of nodes of the assignment relaxation, above only the cheapest arcs are counted");
 DEFINE_int64(vehicle_limit, 0, "Define the maximum number of vehicle");
 DEFINE_bool(nearby, false, "Short segment priority");
 DEFINE_bool(debug, false, "debug display");
 DEFINE_bool(intermediate_solutions, false, "display intermediate solutions");
+DEFINE_int64(intermediate_interval_in_ms, 200, "Minimum time between two intermediate results written");
+DEFINE_bool(vehicle_symmetry_breaking, false, "Use identical vehicles in order");
+DEFINE_bool(arc_elimination, true, "Remove arcs infeasible for every vehicle before search");
+DEFINE_bool(cumul_tightening, true, "Tighten time cumul bounds and horizon before search");
+DEFINE_bool(dimension_elimination, true, "Skip dimensions carrying neither cost nor constraint");
+DEFINE_int32(portfolio_threads, 1, "Number of concurrent searches with different strategies");
+DEFINE_string(local_search_metaheuristic, "GUIDED_LOCAL_SEARCH", "Local search metaheuristic: GREEDY_DESCENT, GUIDED_LOCAL_SEARCH, SIMULATED_ANNEALING or TABU_SEARCH");
+DEFINE_bool(first_solution_racing, false, "Race first solution strategies and search from the best one");
+DEFINE_int64(racing_time_limit_in_ms, 1000, "Time limit of each first solution strategy in the race");
+DEFINE_string(previous_result_file, "", "Result of a previous optimization to start the search from");
+DEFINE_int32(decomposition_cluster_size, 0, "Target number of services per cluster, 0 disables the decomposition");
+DEFINE_int32(decomposition_threads, 4, "Number of sub-problems solved in parallel");
+DEFINE_int64(boundary_improvement_time_in_ms, 0, "Time limit of the re-optimisation of neighbouring clusters, 0 disables it");
+DEFINE_int64(route_subset_improvement_time_in_ms, 0, "Time spent re-optimising subsets of close routes, 0 disables it");
+DEFINE_int64(route_subset_time_in_ms, 1000, "Time limit of the re-optimisation of each subset of routes");
+DEFINE_int32(route_subset_size, 3, "Number of close routes re-optimised together");
+DEFINE_bool(day_decomposition, false, "Give services a day first then solve the days in parallel");
+DEFINE_int32(day_repair_iterations, 1, "Rounds moving the services a day leaves out to another day");
+DEFINE_int64(day_repair_time_in_ms, 1000, "Time limit of the re-optimisation of each day changed by a repair round");
+DEFINE_bool(redispatch, false, "Read updates from stdin after the first solve and re-solve what is left of the routes after each one");
+DEFINE_int64(redispatch_time_in_ms, 100, "Time limit of the local search after each update");
+DEFINE_bool(pipe, false, "Read the problem from stdin and write the intermediate and final results on stdout");
 
 
 namespace operations_research {
@@ -47,7 +85,8 @@ bool CheckOverflow(int64 a, int64 b) {
   return false;
 }
 
-void TWBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, int64 size, int64 min_start, bool loop_route, bool unique_configuration) {
+//  Base penalty of a service, scaled by its priority
+int64 DisjunctionCost(const TSPTWDataDT &data, int64 size) {
   const int size_vehicles = data.Vehicles().size();
   int64 max_time = (2 * data.MaxTime() + data.MaxServiceTime()) * data.MaxTimeCost();
   int64 max_distance = 2 * data.MaxDistance() * data.MaxDistanceCost();
@@ -58,9 +97,31 @@ void TWBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, i
 
   overflow_danger = overflow_danger || CheckOverflow(data_verif, std::pow(2,4) * size);
   data_verif = data_verif * std::pow(2,4) * size;
+  return !overflow_danger && !CheckOverflow(data_verif, size)? data_verif : std::pow(2, 52);
+}
+
+//  Penalty of each service node as set by TWBuilder, -1 when mandatory and
+//  0 for the nodes of a service with several soft time windows, as only one
+//  of them is performed
+std::vector<int64> DisjunctionPenalties(const TSPTWDataDT &data, int64 size) {
+  const int64 disjunction_cost = DisjunctionCost(data, size);
+  std::vector<int64> penalties(data.Size() - 2);
+  for (RoutingModel::NodeIndex i(0); i < data.Size() - 2; ++i) {
+    const bool shared = i > 0 && data.ServiceId(i - 1) == data.ServiceId(i) ||
+      i < data.Size() - 3 && data.ServiceId(i + 1) == data.ServiceId(i);
+    const int64 exclusion_cost = data.ExclusionCost(i);
+    if (size == 1) penalties[i.value()] = -1;
+    else if (shared) penalties[i.value()] = 0;
+    else penalties[i.value()] = exclusion_cost == -1 ? disjunction_cost * std::pow(2, 4 - data.Priority(i)) : exclusion_cost;
+  }
+  return penalties;
+}
+
+void TWBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, int64 size, int64 min_start, bool loop_route, bool unique_configuration) {
+  const int size_vehicles = data.Vehicles().size();
   RoutingModel::NodeIndex i(0);
   int32 tw_index = 0;
-  int64 disjunction_cost = !overflow_danger && !CheckOverflow(data_verif, size)? data_verif : std::pow(2, 52);
+  int64 disjunction_cost = DisjunctionCost(data, size);
   for (int activity = 0; activity < data.SizeMatrix() - 2; ++activity) {
     std::vector<RoutingModel::NodeIndex> *vect = new std::vector<RoutingModel::NodeIndex>(1);
     int64 priority = 4;
@@ -106,6 +167,7 @@ void TWBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, i
 
     std::vector<bool> refill_quantities = data.RefillQuantities(i);
     for (int64 q = 0 ; q < data.Quantities(i).size(); ++q) {
+      if (!routing.HasDimension("quantity" + std::to_string(q))) continue;
       RoutingDimension* quantity_dimension = routing.GetMutableDimension("quantity" + std::to_string(q));
       if (!refill_quantities.at(q)) quantity_dimension->SlackVar(index)->SetValue(0);
       routing.AddVariableMinimizedByFinalizer(quantity_dimension->CumulVar(index));
@@ -137,6 +199,7 @@ void TWBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, i
           }
         }
         for (int64 q = 0 ; q < data.Quantities(i).size(); ++q) {
+          if (!routing.HasDimension("quantity" + std::to_string(q))) continue;
           IntVar *const slack_var = routing.SlackVar(index, "quantity" + std::to_string(q));
           slack_var->SetValue(0);
         }
@@ -162,6 +225,89 @@ void TWBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, i
   }
 }
 
+bool VehicleAllowed(const std::vector<int64> &sticky_vehicle, int v) {
+  if (sticky_vehicle.size() == 0) return true;
+  for (int64 sticky : sticky_vehicle) {
+    if (v == sticky || sticky == -1)
+      return true;
+  }
+  return false;
+}
+
+//  Removes the arcs no vehicle can use, computed once per data and shared
+//  by every model built on it
+void ArcEliminationBuilder(const TSPTWDataDT &data, RoutingModel &routing, int64 horizon) {
+  const TSPTWDataDT::ArcElimination& elimination = data.EliminatedArcs(horizon);
+  for (int v = 0; v < elimination.unreachable.size(); ++v) {
+    for (int32 node : elimination.unreachable[v]) {
+      const int64 index = routing.NodeToIndex(RoutingModel::NodeIndex(node));
+      routing.NextVar(routing.Start(v))->RemoveValue(index);
+      routing.NextVar(index)->RemoveValue(routing.End(v));
+    }
+  }
+  std::vector<int64> removed;
+  for (int i = 0; i < elimination.removed_next.size(); ++i) {
+    if (elimination.removed_next[i].empty()) continue;
+    removed.clear();
+    for (int32 node : elimination.removed_next[i]) {
+      removed.push_back(routing.NodeToIndex(RoutingModel::NodeIndex(node)));
+    }
+    routing.NextVar(routing.NodeToIndex(RoutingModel::NodeIndex(i)))->RemoveValues(removed);
+  }
+  if (FLAGS_debug) std::cout << "Removed arcs : " << elimination.removed_arcs << std::endl;
+}
+
+//  Without lateness on vehicles, no route ends after the latest vehicle end.
+//  The horizon must still allow every service ready time to be set.
+int64 TightenedHorizon(const TSPTWDataDT &data, int64 size) {
+  int64 horizon = 0;
+  for (TSPTWDataDT::Vehicle* vehicle: data.Vehicles()) {
+    if (vehicle->late_multiplier > 0 || vehicle->time_end >= CUSTOM_MAX_INT) return data.Horizon();
+    horizon = std::max(horizon, vehicle->time_end);
+  }
+  for (RoutingModel::NodeIndex i(0); i < size; ++i) {
+    std::vector<int64> ready = data.ReadyTime(i);
+    if (ready.size() > 0 && ready.at(0) < CUSTOM_MAX_INT) horizon = std::max(horizon, ready.at(0));
+  }
+  return std::min(horizon, data.Horizon());
+}
+
+//  Restricts each time cumul to the arrivals reachable from the start of an
+//  allowed vehicle and leaving enough time to reach its end.
+void CumulBoundsBuilder(const TSPTWDataDT &data, RoutingModel &routing, int64 size) {
+  const RoutingModel::NodeIndex start_node = data.Vehicles().at(0)->start;
+  const RoutingModel::NodeIndex stop_node = data.Vehicles().at(0)->stop;
+  int64 tightened = 0;
+  for (RoutingModel::NodeIndex i(0); i < size; ++i) {
+    std::vector<int64> sticky_vehicle = data.VehicleIndices(i);
+    int64 earliest = CUSTOM_MAX_INT;
+    int64 latest = -CUSTOM_MAX_INT;
+    for (int v = 0; v < data.Vehicles().size(); ++v) {
+      if (!VehicleAllowed(sticky_vehicle, v)) continue;
+      TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(v);
+      earliest = std::min(earliest, vehicle->time_start + vehicle->TimePlusServiceTime(start_node, i));
+      if (vehicle->late_multiplier > 0 || vehicle->time_end >= CUSTOM_MAX_INT)
+        latest = CUSTOM_MAX_INT;
+      else
+        latest = std::max(latest, vehicle->time_end - vehicle->TimePlusServiceTime(i, stop_node));
+    }
+    std::vector<int64> ready = data.ReadyTime(i);
+    std::vector<int64> due = data.DueTime(i);
+    if (ready.size() > 0) earliest = std::max(earliest, ready.at(0));
+    if (due.size() > 0 && data.LateMultiplier(i) == 0) latest = std::min(latest, due.back());
+
+    IntVar* cumul_var = routing.CumulVar(routing.NodeToIndex(i), "time");
+    earliest = std::max(earliest, cumul_var->Min());
+    latest = std::min(latest, cumul_var->Max());
+    // Unreachable services are left to the disjunction, and a range falling
+    // between two time windows would empty the domain
+    if (earliest > latest || !cumul_var->Contains(earliest) && !cumul_var->Contains(latest)) continue;
+    if (earliest > cumul_var->Min() || latest < cumul_var->Max()) ++tightened;
+    cumul_var->SetRange(earliest, latest);
+  }
+  if (FLAGS_debug) std::cout << "Tightened time windows : " << tightened << std::endl;
+}
+
 std::vector<IntVar*> RestBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, int64 size) {
   std::vector<IntVar*> breaks;
   for (TSPTWDataDT::Rest* rest: data.Rests()) {
@@ -220,25 +366,142 @@ std::vector<IntVar*> RestBuilder(const TSPTWDataDT &data, RoutingModel &routing,
 void RouteBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, Assignment *assignment) {
   for (TSPTWDataDT::Route* route: data.Routes()) {
     int64 current_index;
+    int64 previous_index = -1;
     IntVar* previous_var = NULL;
     for (std::string service_id: route->service_ids) {
       current_index = data.IdIndex(service_id);
-      if (current_index != -1) {
+      // Services of a contracted sequence share the same node
+      if (current_index != -1 && current_index != previous_index) {
         IntVar* next_var = routing.NextVar(current_index);
         assignment->Add(next_var);
         if (previous_var != NULL) assignment->SetValue(previous_var, current_index);
         IntVar* const vehicle_var = routing.VehicleVar(current_index);
         if (route->vehicle_index >= 0) assignment->SetValue(vehicle_var, route->vehicle_index);
         previous_var = next_var;
+        previous_index = current_index;
       }
     }
   }
 }
 
+//  Routes of the problem attached to a known vehicle, one per vehicle
+std::vector<std::vector<RoutingModel::NodeIndex>> ProblemRoutes(const TSPTWDataDT &data) {
+  std::vector<std::vector<RoutingModel::NodeIndex>> routes(data.Vehicles().size());
+  for (TSPTWDataDT::Route* route: data.Routes()) {
+    if (route->vehicle_index < 0) continue;
+    std::vector<RoutingModel::NodeIndex>& nodes = routes.at(route->vehicle_index);
+    for (std::string service_id: route->service_ids) {
+      const int64 current_index = data.IdIndex(service_id);
+      if (current_index != -1 && (nodes.size() == 0 || nodes.back() != RoutingModel::NodeIndex(current_index)))
+        nodes.push_back(RoutingModel::NodeIndex(current_index));
+    }
+  }
+  return routes;
+}
+
+//  Nodes of a route the vehicle can serve, in one pass along the route
+//  arriving as early as possible. A node is dropped when the vehicle isn't
+//  allowed, when it can't be reached within its hard time windows or back
+//  to the end within the vehicle shift, or when the load swing along the
+//  route exceeds a hard capacity. Quantities are checked again after a
+//  refill, counting quantities are left to the model.
+std::vector<RoutingModel::NodeIndex> ServiceableRoute(const TSPTWDataDT &data, int v, const std::vector<RoutingModel::NodeIndex>& route, int64* dropped) {
+  const TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(v);
+  const int size_quantities = vehicle->capacity.size();
+  std::vector<int64> load(size_quantities, 0);
+  std::vector<int64> min_load(size_quantities, 0);
+  std::vector<int64> max_load(size_quantities, 0);
+  std::vector<RoutingModel::NodeIndex> kept;
+  RoutingModel::NodeIndex previous = vehicle->start;
+  int64 time = vehicle->time_start;
+  for (RoutingModel::NodeIndex node: route) {
+    const std::vector<int64> indices = data.VehicleIndices(node);
+    bool serviceable = indices.empty() || std::find(indices.begin(), indices.end(), v) != indices.end() ||
+      std::find(indices.begin(), indices.end(), -1) != indices.end();
+
+    int64 arrival = time + vehicle->TimePlusServiceTime(previous, node);
+    const std::vector<int64> ready = data.ReadyTime(node);
+    const std::vector<int64> due = data.DueTime(node);
+    int tw = 0;
+    while (tw < due.size() && arrival > due[tw]) ++tw;
+    if (tw < due.size()) arrival = std::max(arrival, ready[tw]);
+    else if (due.size() > 0 && data.LateMultiplier(node) == 0) serviceable = false;
+    if (vehicle->late_multiplier == 0 && vehicle->time_end < CUSTOM_MAX_INT &&
+        arrival + vehicle->TimePlusServiceTime(node, vehicle->stop) > vehicle->time_end) serviceable = false;
+
+    std::vector<int64> node_load(load);
+    std::vector<int64> node_min_load(min_load);
+    std::vector<int64> node_max_load(max_load);
+    const std::vector<int64> quantities = data.Quantities(node);
+    const std::vector<bool> refills = data.RefillQuantities(node);
+    for (int q = 0; q < size_quantities && q < quantities.size(); ++q) {
+      if (vehicle->counting[q]) continue;
+      if (q < refills.size() && refills[q]) {
+        node_load[q] = node_min_load[q] = node_max_load[q] = 0;
+        continue;
+      }
+      node_load[q] += quantities[q];
+      node_min_load[q] = std::min(node_min_load[q], node_load[q]);
+      node_max_load[q] = std::max(node_max_load[q], node_load[q]);
+      if (vehicle->capacity[q] >= 0 && vehicle->overload_multiplier[q] == 0 && node_max_load[q] - node_min_load[q] > vehicle->capacity[q])
+        serviceable = false;
+    }
+
+    if (!serviceable) {
+      ++*dropped;
+      continue;
+    }
+    kept.push_back(node);
+    previous = node;
+    time = arrival;
+    load.swap(node_load);
+    min_load.swap(node_min_load);
+    max_load.swap(node_max_load);
+  }
+  return kept;
+}
+
+//  Keeps the part of the initial routes which satisfies the current
+//  constraints: nodes the vehicles can't serve are dropped along the
+//  routes first, then routes which the model still rejects, for relations
+//  or breaks, are left out whole. Must be called on a closed model.
+std::vector<std::vector<RoutingModel::NodeIndex>> RepairRoutes(const TSPTWDataDT &data, RoutingModel &routing, const std::vector<std::vector<RoutingModel::NodeIndex>>& routes) {
+  if (routing.ReadAssignmentFromRoutes(routes, true) != NULL) return routes;
+
+  std::vector<std::vector<RoutingModel::NodeIndex>> repaired(routes.size());
+  int64 dropped = 0;
+  for (int v = 0; v < routes.size(); ++v) {
+    repaired[v] = ServiceableRoute(data, v, routes[v], &dropped);
+  }
+  if (routing.ReadAssignmentFromRoutes(repaired, true) == NULL) {
+    const std::vector<std::vector<RoutingModel::NodeIndex>> serviceable = repaired;
+    for (int v = 0; v < routes.size(); ++v) repaired[v].clear();
+    for (int v = 0; v < routes.size(); ++v) {
+      repaired[v] = serviceable[v];
+      if (routing.ReadAssignmentFromRoutes(repaired, true) != NULL) continue;
+      dropped += repaired[v].size();
+      repaired[v].clear();
+    }
+  }
+  std::cout << "Nodes dropped from initial routes : " << dropped << std::endl;
+  return repaired;
+}
+
 void RelationBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, int64 size, Assignment *assignment) {
 
-  Solver::IndexEvaluator1 vehicle_evaluator = [&data](int64 index) {
-    return data.VehicleDay(index);
+  // Day of each vehicle shifted by one, an unperformed node has vehicle -1.
+  // Day variables are built once per node on the first relation needing it.
+  std::vector<int64> vehicle_days(1, -1);
+  for (int v = 0; v < routing.vehicles(); ++v) {
+    vehicle_days.push_back(data.VehicleDay(v));
+  }
+  std::map<int64, IntVar*> day_vars;
+  auto day_var = [&](int64 index) {
+    std::map<int64, IntVar*>::const_iterator it = day_vars.find(index);
+    if (it != day_vars.end()) return it->second;
+    IntVar *const day = solver->MakeElement(vehicle_days, solver->MakeSum(routing.VehicleVar(index), 1)->Var())->Var();
+    day_vars[index] = day;
+    return day;
   };
 
   for (TSPTWDataDT::Relation* relation: data.Relations()) {
@@ -324,10 +587,8 @@ void RelationBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *sol
 
           solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
 
-          IntExpr *const previous_part = solver->MakeProd(isConstraintActive,
-            solver->MakeElement(vehicle_evaluator, routing.VehicleVar(previous_index)));
-          IntExpr *const next_part = solver->MakeProd(isConstraintActive,
-            solver->MakeElement(vehicle_evaluator, routing.VehicleVar(current_index)));
+          IntExpr *const previous_part = solver->MakeProd(isConstraintActive, day_var(previous_index));
+          IntExpr *const next_part = solver->MakeProd(isConstraintActive, day_var(current_index));
           IntExpr *const lapse = solver->MakeProd(isConstraintActive, relation->lapse);
           solver->AddConstraint(solver->MakeLessOrEqual(solver->MakeSum(previous_part, lapse), next_part));
           previous_index = current_index;
@@ -342,8 +603,8 @@ void RelationBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *sol
           IntExpr *const isConstraintActive = solver->MakeProd(previous_active_var, active_var)->Var();
 
           solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
-          IntExpr *const previous_part = solver->MakeElement(vehicle_evaluator, routing.VehicleVar(previous_index));
-          IntExpr *const next_part = solver->MakeElement(vehicle_evaluator, routing.VehicleVar(current_index));
+          IntExpr *const previous_part = day_var(previous_index);
+          IntExpr *const next_part = day_var(current_index);
 
           solver->AddConstraint(solver->MakeLessOrEqual(solver->MakeDifference(next_part, previous_part), relation->lapse));
           previous_index = current_index;
@@ -433,7 +694,137 @@ void RelationBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *sol
   }
 }
 
-int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
+bool InterchangeableVehicles(const TSPTWDataDT::Vehicle* a, const TSPTWDataDT::Vehicle* b) {
+  return a->problem_matrix_index == b->problem_matrix_index && a->value_matrix_index == b->value_matrix_index &&
+    a->vehicle_indices.at(a->size - 2) == b->vehicle_indices.at(b->size - 2) && a->vehicle_indices.at(a->size - 1) == b->vehicle_indices.at(b->size - 1) &&
+    a->capacity == b->capacity && a->counting == b->counting && a->overload_multiplier == b->overload_multiplier &&
+    a->time_start == b->time_start && a->time_end == b->time_end && a->late_multiplier == b->late_multiplier &&
+    a->cost_fixed == b->cost_fixed && a->cost_distance_multiplier == b->cost_distance_multiplier &&
+    a->cost_time_multiplier == b->cost_time_multiplier && a->cost_waiting_time_multiplier == b->cost_waiting_time_multiplier &&
+    a->cost_value_multiplier == b->cost_value_multiplier && a->duration == b->duration && a->force_start == b->force_start &&
+    a->day_index == b->day_index && a->max_ride_time_ == b->max_ride_time_ && a->max_ride_distance_ == b->max_ride_distance_;
+}
+
+//  Groups vehicles which can swap their routes without changing the cost or
+//  the feasibility of a solution.
+std::vector<std::vector<int>> VehicleClasses(const TSPTWDataDT &data) {
+  const int size_vehicles = data.Vehicles().size();
+  std::vector<bool> excluded(size_vehicles, false);
+  for (TSPTWDataDT::Route* route: data.Routes()) {
+    if (route->vehicle_index >= 0) excluded[route->vehicle_index] = true;
+  }
+  for (int v = 0; v < size_vehicles; ++v) {
+    if (data.Vehicles().at(v)->break_size > 0) excluded[v] = true;
+  }
+
+  // Vehicles must also be listed alike by every service
+  std::vector<std::vector<bool>> service_lists;
+  for (RoutingModel::NodeIndex i(0); i < data.Size() - 2; ++i) {
+    std::vector<int64> sticky_vehicle = data.VehicleIndices(i);
+    if (sticky_vehicle.size() == 0 || std::find(sticky_vehicle.begin(), sticky_vehicle.end(), -1) != sticky_vehicle.end()) continue;
+    std::vector<bool> listed(size_vehicles, false);
+    for (int64 sticky : sticky_vehicle) {
+      if (sticky >= 0 && sticky < size_vehicles) listed[sticky] = true;
+    }
+    service_lists.push_back(listed);
+  }
+
+  std::vector<std::vector<int>> classes;
+  for (int v = 0; v < size_vehicles; ++v) {
+    if (excluded[v]) continue;
+    bool found = false;
+    for (std::vector<int>& vehicle_class : classes) {
+      const int reference = vehicle_class.front();
+      bool same = InterchangeableVehicles(data.Vehicles().at(reference), data.Vehicles().at(v));
+      for (int l = 0; same && l < service_lists.size(); ++l) {
+        same = service_lists[l][reference] == service_lists[l][v];
+      }
+      if (same) {
+        vehicle_class.push_back(v);
+        found = true;
+        break;
+      }
+    }
+    if (!found) classes.push_back({v});
+  }
+  return classes;
+}
+
+//  Within a class of interchangeable vehicles, a vehicle can only be used if
+//  the previous one is.
+void SymmetryBuilder(const TSPTWDataDT &data, RoutingModel &routing, Solver *solver, const std::vector<IntVar*> &used_vehicles) {
+  for (const std::vector<int>& vehicle_class : VehicleClasses(data)) {
+    if (FLAGS_debug && vehicle_class.size() > 1) std::cout << "Interchangeable vehicles : " << vehicle_class.size() << std::endl;
+    for (int v = 1; v < vehicle_class.size(); ++v) {
+      solver->AddConstraint(solver->MakeLessOrEqual(used_vehicles[vehicle_class[v]], used_vehicles[vehicle_class[v - 1]]));
+    }
+  }
+}
+
+//  Transit evaluators specialised on the features found at load time
+RoutingModel::NodeEvaluator2* TimeEvaluator(TSPTWDataDT::Vehicle* vehicle, bool ride_limit, bool setup) {
+  if (ride_limit && setup)
+    return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastTimePlusServiceTime<true, true>);
+  else if (ride_limit)
+    return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastTimePlusServiceTime<true, false>);
+  else if (setup)
+    return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastTimePlusServiceTime<false, true>);
+  return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastTimePlusServiceTime<false, false>);
+}
+
+RoutingModel::NodeEvaluator2* DistanceEvaluator(TSPTWDataDT::Vehicle* vehicle, bool ride_limit, bool service_distance) {
+  if (ride_limit && service_distance)
+    return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastDistancePlusServiceDistance<true, true>);
+  else if (ride_limit)
+    return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastDistancePlusServiceDistance<true, false>);
+  else if (service_distance)
+    return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastDistancePlusServiceDistance<false, true>);
+  return NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::FastDistancePlusServiceDistance<false, false>);
+}
+
+//  Criteria of the stopping policy, from flags
+StoppingPolicy* StoppingPolicyBuilder(Solver *solver, IntVar *objective, const TSPTWDataDT &data) {
+  StoppingPolicy * const policy = MakeStoppingPolicy(solver, objective);
+  if (FLAGS_no_solution_improvement_limit > 0 || FLAGS_initial_time_out_no_solution_improvement > 0)
+    policy->AddCriterion(new NoImprovementCriterion(FLAGS_no_solution_improvement_limit, FLAGS_initial_time_out_no_solution_improvement, FLAGS_time_out_multiplier));
+  if (FLAGS_stop_wall_time_in_ms > 0)
+    policy->AddCriterion(new WallTimeCriterion(FLAGS_stop_wall_time_in_ms));
+  if (FLAGS_stop_plateau_in_ms > 0)
+    policy->AddCriterion(new PlateauCriterion(FLAGS_stop_plateau_in_ms, FLAGS_stop_plateau_tolerance));
+  if (FLAGS_stop_improvement_window_in_ms > 0)
+    policy->AddCriterion(new ImprovementRateCriterion(FLAGS_stop_improvement_window_in_ms, FLAGS_stop_min_improvement_rate));
+  if (FLAGS_stop_solution_limit > 0)
+    policy->AddCriterion(new SolutionCountCriterion(FLAGS_stop_solution_limit));
+  if (FLAGS_stop_gap > 0)
+    policy->AddCriterion(new GapCriterion(FLAGS_stop_gap, data.LowerBound()));
+  return policy;
+}
+
+//  Overrides the default search of TSPTWSolver, UNSET values keep the default
+struct SearchStrategy {
+  SearchStrategy(int w, FirstSolutionStrategy::Value f, LocalSearchMetaheuristic::Value m):
+    worker(w), first_solution(f), metaheuristic(m), first_solution_only(false), time_limit_ms(0), initial_routes(NULL){}
+  int worker;
+  FirstSolutionStrategy::Value first_solution;
+  LocalSearchMetaheuristic::Value metaheuristic;
+  bool first_solution_only;
+  int64 time_limit_ms;
+  //  Routes the search starts from, as node sequences without start and end
+  const std::vector<std::vector<RoutingModel::NodeIndex>>* initial_routes;
+};
+
+//  Solution found by TSPTWSolver, returned instead of being written
+struct SearchOutcome {
+  SearchOutcome():
+    first_solution(FirstSolutionStrategy::UNSET), cost(-1), duration(0){}
+  FirstSolutionStrategy::Value first_solution;
+  int64 cost;
+  double duration;
+  std::vector<std::vector<RoutingModel::NodeIndex>> routes;
+  ortools_result::Result result;
+};
+
+int TSPTWSolver(const TSPTWDataDT &data, std::string filename, const SearchStrategy* strategy = NULL, SharedIncumbent* incumbent = NULL, SearchOutcome* outcome = NULL) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
 
   ortools_result::Result result;
@@ -453,32 +844,58 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
   }
   RoutingModel routing(size, size_vehicles, *start_ends);
 
+  if (FLAGS_debug && data.UnserviceableIds().size() > 0) {
+    std::cout << "Unserviceable services : " << data.UnserviceableIds().size() << std::endl;
+  }
+
   // Dimensions
-  const int64 horizon = data.Horizon() * (has_lateness && !CheckOverflow(data.Horizon(), 2) ? 2 : 1);
+  const int64 horizon = FLAGS_cumul_tightening && !has_lateness && size_vehicles > 0 ? TightenedHorizon(data, size - 2) :
+    data.Horizon() * (has_lateness && !CheckOverflow(data.Horizon(), 2) ? 2 : 1);
   std::vector<ResultCallback2<long long int, IntType<operations_research::RoutingNodeIndex_tag_, int>, IntType<operations_research::RoutingNodeIndex_tag_, int> >*> time_evaluators;
   std::vector<ResultCallback2<long long int, IntType<operations_research::RoutingNodeIndex_tag_, int>, IntType<operations_research::RoutingNodeIndex_tag_, int> >*> distance_evaluators;
   std::vector<ResultCallback2<long long int, IntType<operations_research::RoutingNodeIndex_tag_, int>, IntType<operations_research::RoutingNodeIndex_tag_, int> >*> value_evaluators;
   std::vector<ResultCallback2<long long int, IntType<operations_research::RoutingNodeIndex_tag_, int>, IntType<operations_research::RoutingNodeIndex_tag_, int> >*> time_order_evaluators;
   std::vector<ResultCallback2<long long int, IntType<operations_research::RoutingNodeIndex_tag_, int>, IntType<operations_research::RoutingNodeIndex_tag_, int> >*> distance_order_evaluators;
+  const bool has_setup = data.HasSetupTimes();
+  const bool has_service_distance = data.HasServiceDistances();
   for (TSPTWDataDT::Vehicle* vehicle: data.Vehicles()) {
-    time_evaluators.push_back(NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::TimePlusServiceTime));
-    distance_evaluators.push_back(NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::Distance));
+    time_evaluators.push_back(TimeEvaluator(vehicle, vehicle->max_ride_time_ > 0, has_setup));
+    distance_evaluators.push_back(DistanceEvaluator(vehicle, vehicle->max_ride_distance_ > 0, has_service_distance));
     value_evaluators.push_back(NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::ValuePlusServiceValue));
     if (FLAGS_nearby) {
       time_order_evaluators.push_back(NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::TimeOrder));
       distance_order_evaluators.push_back(NewPermanentCallback(vehicle, &TSPTWDataDT::Vehicle::DistanceOrder));
     }
   }
+  // Dimensions without cost nor constraint are skipped
+  bool time_without_wait_cost = !FLAGS_dimension_elimination;
+  bool distance_cost = !FLAGS_dimension_elimination;
+  bool value_cost = !FLAGS_dimension_elimination;
+  bool time_order_cost = !FLAGS_dimension_elimination;
+  bool distance_order_cost = !FLAGS_dimension_elimination;
+  for (TSPTWDataDT::Vehicle* vehicle: data.Vehicles()) {
+    time_without_wait_cost |= vehicle->cost_time_multiplier - vehicle->cost_waiting_time_multiplier > 0;
+    distance_cost |= vehicle->cost_distance_multiplier != 0;
+    value_cost |= vehicle->cost_value_multiplier != 0;
+    time_order_cost |= vehicle->cost_time_multiplier / 5 != 0;
+    distance_order_cost |= vehicle->cost_distance_multiplier / 5 != 0;
+  }
   routing.AddDimensionWithVehicleTransits(time_evaluators, horizon, horizon, false, "time");
-  routing.AddDimensionWithVehicleTransits(time_evaluators, horizon, horizon, false, "time_without_wait");
-  routing.AddDimensionWithVehicleTransits(distance_evaluators, 0, LLONG_MAX, true, "distance");
-  routing.AddDimensionWithVehicleTransits(value_evaluators, 0, LLONG_MAX, true, "value");
+  if (time_without_wait_cost)
+    routing.AddDimensionWithVehicleTransits(time_evaluators, horizon, horizon, false, "time_without_wait");
+  if (distance_cost)
+    routing.AddDimensionWithVehicleTransits(distance_evaluators, 0, LLONG_MAX, true, "distance");
+  if (value_cost)
+    routing.AddDimensionWithVehicleTransits(value_evaluators, 0, LLONG_MAX, true, "value");
   if (FLAGS_nearby) {
-    routing.AddDimensionWithVehicleTransits(time_order_evaluators, 0, LLONG_MAX, true, "time_order");
-    routing.AddDimensionWithVehicleTransits(distance_order_evaluators, 0, LLONG_MAX, true, "distance_order");
+    if (time_order_cost)
+      routing.AddDimensionWithVehicleTransits(time_order_evaluators, 0, LLONG_MAX, true, "time_order");
+    if (distance_order_cost)
+      routing.AddDimensionWithVehicleTransits(distance_order_evaluators, 0, LLONG_MAX, true, "distance_order");
   }
 
   for (int64 i = 0; i < data.Vehicles().at(0)->capacity.size(); ++i) {
+    if (FLAGS_dimension_elimination && !data.QuantityUsed(i)) continue;
     std::vector<int64> capacities;
     for(TSPTWDataDT::Vehicle* vehicle: data.Vehicles()) {
       int64 coef = vehicle->overload_multiplier[i];
@@ -501,13 +918,18 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
     // Vehicle costs
     int64 without_wait_cost = vehicle->cost_time_multiplier - vehicle->cost_waiting_time_multiplier;
     routing.GetMutableDimension("time")->SetSpanCostCoefficientForVehicle((int64)std::max(vehicle->cost_time_multiplier - without_wait_cost, (int64)0), v);
-    routing.GetMutableDimension("time_without_wait")->SetSpanCostCoefficientForVehicle((int64)std::max(without_wait_cost, (int64)0), v);
-    routing.GetMutableDimension("distance")->SetSpanCostCoefficientForVehicle(vehicle->cost_distance_multiplier, v);
-    routing.GetMutableDimension("value")->SetSpanCostCoefficientForVehicle(vehicle->cost_value_multiplier, v);
+    if (time_without_wait_cost)
+      routing.GetMutableDimension("time_without_wait")->SetSpanCostCoefficientForVehicle((int64)std::max(without_wait_cost, (int64)0), v);
+    if (distance_cost)
+      routing.GetMutableDimension("distance")->SetSpanCostCoefficientForVehicle(vehicle->cost_distance_multiplier, v);
+    if (value_cost)
+      routing.GetMutableDimension("value")->SetSpanCostCoefficientForVehicle(vehicle->cost_value_multiplier, v);
     routing.SetFixedCostOfVehicle(vehicle->cost_fixed, v);
     if (FLAGS_nearby) {
-      routing.GetMutableDimension("time_order")->SetSpanCostCoefficientForVehicle(vehicle->cost_time_multiplier / 5, v);
-      routing.GetMutableDimension("distance_order")->SetSpanCostCoefficientForVehicle(vehicle->cost_distance_multiplier / 5, v);
+      if (time_order_cost)
+        routing.GetMutableDimension("time_order")->SetSpanCostCoefficientForVehicle(vehicle->cost_time_multiplier / 5, v);
+      if (distance_order_cost)
+        routing.GetMutableDimension("distance_order")->SetSpanCostCoefficientForVehicle(vehicle->cost_distance_multiplier / 5, v);
     }
 
     int64 start_index = routing.Start(v);
@@ -545,7 +967,7 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
 
     for (int64 i = 0; i < vehicle->capacity.size(); ++i) {
       int64 coef = vehicle->overload_multiplier[i];
-      if(vehicle->capacity[i] >= 0) {
+      if(vehicle->capacity[i] >= 0 && routing.HasDimension("quantity" + std::to_string(i))) {
         if(coef > 0) {
           routing.GetMutableDimension("quantity" + std::to_string(i))->SetEndCumulVarSoftUpperBound(v, vehicle->capacity[i], coef);
         } else {
@@ -559,6 +981,9 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
   if (FLAGS_vehicle_limit > 0) {
     solver->AddConstraint(solver->MakeLessOrEqual(solver->MakeSum(used_vehicles), (int64)FLAGS_vehicle_limit));
   }
+  if (FLAGS_vehicle_symmetry_breaking) {
+    SymmetryBuilder(data, routing, solver, used_vehicles);
+  }
 
   // Setting solve parameters indicators
   int route_nbr = 0;
@@ -567,7 +992,7 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
   bool force_start = false;
   bool loop_route = true;
   bool unique_configuration = true;
-  RoutingModel::NodeIndex compareNodeIndex = routing.IndexToNode(rand() % (data.SizeMatrix() - 2));
+  RoutingModel::NodeIndex compareNodeIndex = routing.IndexToNode(rand() % std::max(data.SizeMatrix() - 2, 1));
   TSPTWDataDT::Vehicle* previous_vehicle = NULL;
   for (int route_nbr = 0; route_nbr < routing.vehicles(); route_nbr++) {
     TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(route_nbr);
@@ -594,6 +1019,12 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
 
   // Setting visit time windows
   TWBuilder(data, routing, solver, size - 2, min_start, loop_route, unique_configuration);
+  if (FLAGS_cumul_tightening && size_vehicles > 0) {
+    CumulBoundsBuilder(data, routing, size - 2);
+  }
+  if (FLAGS_arc_elimination && size_vehicles > 0) {
+    ArcEliminationBuilder(data, routing, horizon);
+  }
   RouteBuilder(data, routing, solver, assignment);
   std::vector<IntVar*> breaks;
   // Setting rest time windows
@@ -636,112 +1067,778 @@ int TSPTWSolver(const TSPTWDataDT &data, std::string filename) {
   // parameters.set_first_solution_strategy(FirstSolutionStrategy::LOCAL_CHEAPEST_ARC);
   // parameters.set_first_solution_strategy(FirstSolutionStrategy::ROUTING_BEST_INSERTION);
 
-  // parameters.set_local_search_metaheuristic(LocalSearchMetaheuristic::GREEDY_DESCENT);
-  parameters.set_local_search_metaheuristic(LocalSearchMetaheuristic::GUIDED_LOCAL_SEARCH);
-  // parameters.set_guided_local_search_lambda_coefficient(0.5);
-  // parameters.set_local_search_metaheuristic(LocalSearchMetaheuristic::SIMULATED_ANNEALING);
-  // parameters.set_local_search_metaheuristic(LocalSearchMetaheuristic::TABU_SEARCH);
+  // The GLS lambda coefficient and the local search operators are read from
+  // the routing_ flags by BuildSearchParametersFromFlags
+  LocalSearchMetaheuristic::Value metaheuristic;
+  if (!LocalSearchMetaheuristic::Value_Parse(FLAGS_local_search_metaheuristic, &metaheuristic)) {
+    std::cout << "Unknown metaheuristic " << FLAGS_local_search_metaheuristic << ", using GUIDED_LOCAL_SEARCH" << std::endl;
+    metaheuristic = LocalSearchMetaheuristic::GUIDED_LOCAL_SEARCH;
+  }
+  if (FLAGS_debug) std::cout << "Local search metaheuristic : " << LocalSearchMetaheuristic::Value_Name(metaheuristic) << std::endl;
+  parameters.set_local_search_metaheuristic(metaheuristic);
+
+  if (strategy != NULL) {
+    if (strategy->first_solution != FirstSolutionStrategy::UNSET)
+      parameters.set_first_solution_strategy(strategy->first_solution);
+    if (strategy->metaheuristic != LocalSearchMetaheuristic::UNSET)
+      parameters.set_local_search_metaheuristic(strategy->metaheuristic);
+  }
 
   if (FLAGS_time_limit_in_ms > 0) {
     parameters.set_time_limit_ms(FLAGS_time_limit_in_ms);
   }
+  const bool first_solution_only = strategy != NULL && strategy->first_solution_only;
+  if (strategy != NULL && strategy->time_limit_ms > 0) {
+    parameters.set_time_limit_ms(strategy->time_limit_ms);
+  }
   routing.CloseModelWithParameters(parameters);
 
-  LoggerMonitor * const logger = MakeLoggerMonitor(data, &routing, min_start, size_matrix, breaks, FLAGS_debug, FLAGS_intermediate_solutions, &result, filename, true);
+  // Initial routes are locked for the first solution heuristic, which inserts
+  // the remaining nodes; local search is then free to change them
+  bool initial_routes = false;
+  std::vector<std::vector<RoutingModel::NodeIndex>> routes = strategy != NULL && strategy->initial_routes != NULL ? *strategy->initial_routes : ProblemRoutes(data);
+  for (const std::vector<RoutingModel::NodeIndex>& nodes: routes) {
+    if (nodes.size() > 0) initial_routes = true;
+  }
+  if (initial_routes) {
+    initial_routes = routing.ApplyLocksToAllVehicles(RepairRoutes(data, routing, routes), false);
+    if (!initial_routes) std::cout << "Initial routes rejected" << std::endl;
+  }
+
+  const RouteExtractor extractor(data, routing, breaks);
+  std::unique_ptr<IntermediateWriter> writer;
+  if (FLAGS_intermediate_solutions && !first_solution_only && outcome == NULL)
+    writer.reset(new IntermediateWriter(extractor, filename, incumbent, strategy != NULL ? strategy->worker : 0, FLAGS_intermediate_interval_in_ms));
+  LoggerMonitor * const logger = MakeLoggerMonitor(data, &routing, min_start, size_matrix, breaks, FLAGS_debug, writer.get(), true);
   routing.AddSearchMonitor(logger);
 
-  if (data.Size() > 3) {
-    if (FLAGS_no_solution_improvement_limit > 0 || FLAGS_initial_time_out_no_solution_improvement > 0) {
-      NoImprovementLimit * const no_improvement_limit = MakeNoImprovementLimit(routing.solver(), routing.CostVar(), FLAGS_no_solution_improvement_limit, FLAGS_initial_time_out_no_solution_improvement, FLAGS_time_out_multiplier, true);
-      routing.AddSearchMonitor(no_improvement_limit);
-    }
+  if (first_solution_only) {
+    SearchLimit * const limit = solver->MakeLimit(kint64max,kint64max,kint64max,1);
+    routing.AddSearchMonitor(limit);
+  } else if (data.Size() > 3) {
+    StoppingPolicy * const stopping_policy = StoppingPolicyBuilder(routing.solver(), routing.CostVar(), data);
+    if (stopping_policy->HasCriteria()) routing.AddSearchMonitor(stopping_policy);
   } else {
     SearchLimit * const limit = solver->MakeLimit(kint64max,kint64max,kint64max,1);
     routing.AddSearchMonitor(limit);
   }
 
   const Assignment *solution;
-  if (data.OrderCounter() == 1) {
+  if (initial_routes) {
+    solution = routing.SolveWithParameters(parameters);
+  } else if (data.OrderCounter() == 1) {
     routing.solver()->CheckAssignment(assignment);
     solution = routing.SolveFromAssignmentWithParameters(assignment, parameters);
   } else {
     solution = routing.SolveWithParameters(parameters);
   }
+  if (writer) writer->Stop();
 
   if (solution != NULL) {
-    if (result.routes_size() > 0) result.clear_routes();
-    int current_break = 0;
-    for (int route_nbr = 0; route_nbr < routing.vehicles(); route_nbr++) {
-      int route_break = 0;
-      ortools_result::Route* route = result.add_routes();
-      int previous_index = -1;
-      for (int64 index = routing.Start(route_nbr); !routing.IsEnd(index); index = solution->Value(routing.NextVar(index))) {
-        ortools_result::Activity* activity = route->add_activities();
-        RoutingModel::NodeIndex nodeIndex = routing.IndexToNode(index);
-        activity->set_index(data.MatrixIndex(nodeIndex));
-        activity->set_start_time(solution->Min(routing.GetMutableDimension("time")->CumulVar(index)));
-        if (previous_index == -1) activity->set_type("start");
-        else activity->set_type("service");
-        for (int64 q = 0 ; q < data.Quantities(RoutingModel::NodeIndex(0)).size(); ++q) {
-          double exchange = solution->Min(routing.CumulVar(solution->Value(routing.NextVar(index)), "quantity" + std::to_string(q)));
-          activity->add_quantities(exchange/1000.);
-        }
-
-        if (current_break < data.Rests().size() && data.Vehicles().at(route_nbr)->break_size > 0 && solution->Value(breaks[current_break]) == index) {
-          ortools_result::Activity* break_activity = route->add_activities();
-          break_activity->set_index(route_break);
-          break_activity->set_type("break");
-          current_break++;
-          route_break++;
-        }
-        previous_index = index;
-      }
-      if (current_break < data.Rests().size() && data.Vehicles().at(route_nbr)->break_size > 0 && solution->Value(breaks[current_break]) == routing.End(route_nbr)) {
-          ortools_result::Activity* break_activity = route->add_activities();
-          break_activity->set_index(route_break);
-          break_activity->set_type("break");
-          current_break++;
-          route_break++;
-      }
-      ortools_result::Activity* end_activity = route->add_activities();
-      RoutingModel::NodeIndex nodeIndex = routing.IndexToNode(routing.End(route_nbr));
-      end_activity->set_index(data.MatrixIndex(nodeIndex));
-      end_activity->set_start_time(solution->Min(routing.GetMutableDimension("time")->CumulVar(routing.End(route_nbr))));
-      end_activity->set_type("end");
-    }
+    RouteSnapshot snapshot;
+    extractor.Capture(solution, &snapshot);
+    extractor.BuildResult(snapshot, &result);
 
     std::vector<double> scores = logger->GetFinalScore();
     result.set_cost((int64)scores[0]);
     result.set_duration(scores[1]);
     result.set_iterations(scores[2]);
+    // The bound is reported only if it was known before the search ended
+    const int64 lower_bound = data.LowerBound()->load();
+    if (lower_bound != kint64min) {
+      const int64 cost = solution->ObjectiveValue();
+      result.set_lower_bound((int64)(lower_bound / 1000.0));
+      result.set_gap(cost > 0 ? (double)(cost - std::min(lower_bound, cost)) / cost : 0);
+      std::cout << "Gap : " << result.gap() << std::endl;
+    }
 
-    std::fstream output(filename, std::ios::out | std::ios::trunc | std::ios::binary);
-    if (!result.SerializeToOstream(&output)) {
-      std::cout << "Failed to write result." << std::endl;
-      return -1;
+    if (outcome != NULL) {
+      outcome->first_solution = parameters.first_solution_strategy();
+      outcome->cost = solution->ObjectiveValue();
+      outcome->duration = scores[1];
+      routing.AssignmentToRoutes(*solution, &outcome->routes);
+      outcome->result = result;
+      return 0;
+    }
+
+    if (incumbent != NULL) {
+      // The portfolio writes the best result once every search is over
+      incumbent->Publish(solution->ObjectiveValue(), result, strategy != NULL ? strategy->worker : 0, "");
+      logger->GetFinalLog();
+      return 0;
     }
-    output.close();
+
+    if (!WriteResultFile(result, filename)) return -1;
 
     logger->GetFinalLog();
   } else {
     std::cout << "No solution found..." << std::endl;
   }
 
-  google::protobuf::ShutdownProtobufLibrary();
   return 0;
 }
 
+//  Maps the routes of a previous result to the current nodes by vehicle and
+//  service ids. Services which no longer exist are skipped.
+bool ReadPreviousRoutes(const TSPTWDataDT &data, const std::string& filename, std::vector<std::vector<RoutingModel::NodeIndex>>* routes) {
+  ortools_result::Result previous;
+  {
+    std::fstream input(filename, std::ios::in | std::ios::binary);
+    if (!previous.ParseFromIstream(&input)) {
+      std::cout << "Failed to parse previous result." << std::endl;
+      return false;
+    }
+  }
+
+  const int size_vehicles = data.Vehicles().size();
+  routes->assign(size_vehicles, std::vector<RoutingModel::NodeIndex>());
+  int64 mapped = 0;
+  for (const ortools_result::Route& route: previous.routes()) {
+    int vehicle_index = -1;
+    for (int v = 0; v < size_vehicles; ++v) {
+      if (data.Vehicles().at(v)->id == route.vehicle_id()) vehicle_index = v;
+    }
+    if (vehicle_index == -1) continue;
+
+    std::vector<RoutingModel::NodeIndex>& nodes = routes->at(vehicle_index);
+    for (const ortools_result::Activity& activity: route.activities()) {
+      if (activity.type() != "service") continue;
+      const int64 node = data.IdIndex(activity.id());
+      // Services of a contracted node follow each other
+      if (node == -1 || nodes.size() > 0 && nodes.back() == RoutingModel::NodeIndex(node)) continue;
+      nodes.push_back(RoutingModel::NodeIndex(node));
+      ++mapped;
+    }
+  }
+  std::cout << "Services from previous result : " << mapped << std::endl;
+  return mapped > 0;
+}
+
+//  Starts the search from the routes of a previous result, or from scratch
+//  if none of them can be reused.
+int WarmStartSolver(const TSPTWDataDT &data, std::string filename, const std::string& previous_filename) {
+  std::vector<std::vector<RoutingModel::NodeIndex>> routes;
+  if (!ReadPreviousRoutes(data, previous_filename, &routes)) return TSPTWSolver(data, filename);
+
+  SearchStrategy strategy(0, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET);
+  strategy.initial_routes = &routes;
+  return TSPTWSolver(data, filename, &strategy);
+}
+
+//  Builds a first solution with several strategies in parallel, each within
+//  a short time limit, then runs the local search from the cheapest one.
+int RacingSolver(const TSPTWDataDT &data, std::string filename) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  std::vector<SearchStrategy> strategies = {
+    SearchStrategy(0, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET),
+    SearchStrategy(1, FirstSolutionStrategy::PARALLEL_CHEAPEST_INSERTION, LocalSearchMetaheuristic::UNSET),
+    SearchStrategy(2, FirstSolutionStrategy::LOCAL_CHEAPEST_INSERTION, LocalSearchMetaheuristic::UNSET),
+    SearchStrategy(3, FirstSolutionStrategy::PATH_CHEAPEST_ARC, LocalSearchMetaheuristic::UNSET),
+    SearchStrategy(4, FirstSolutionStrategy::SAVINGS, LocalSearchMetaheuristic::UNSET),
+    SearchStrategy(5, FirstSolutionStrategy::GLOBAL_CHEAPEST_ARC, LocalSearchMetaheuristic::UNSET)
+  };
+  const double start_time = base::GetCurrentTimeNanos();
+  std::vector<SearchOutcome> outcomes(strategies.size());
+  std::vector<std::thread> workers;
+  for (int s = 0; s < strategies.size(); ++s) {
+    strategies[s].first_solution_only = true;
+    strategies[s].time_limit_ms = FLAGS_time_limit_in_ms > 0 ? std::min(FLAGS_racing_time_limit_in_ms, FLAGS_time_limit_in_ms) : FLAGS_racing_time_limit_in_ms;
+    workers.push_back(std::thread([&data, &strategies, &outcomes, s]() {
+      TSPTWSolver(data, "", &strategies[s], NULL, &outcomes[s]);
+    }));
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  int winner = -1;
+  for (int s = 0; s < outcomes.size(); ++s) {
+    if (outcomes[s].cost < 0) continue;
+    std::cout << "Race " << FirstSolutionStrategy::Value_Name(outcomes[s].first_solution) << " Cost : " << (int64)(outcomes[s].cost / 1000.0) << " Time : " << outcomes[s].duration << std::endl;
+    if (winner == -1 || outcomes[s].cost < outcomes[winner].cost) winner = s;
+  }
+
+  // The search after the race gets what is left of the time limit
+  SearchStrategy strategy(0, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET);
+  if (FLAGS_time_limit_in_ms > 0)
+    strategy.time_limit_ms = std::max<int64>(FLAGS_time_limit_in_ms - (int64)(1e-6 * (base::GetCurrentTimeNanos() - start_time)), 1);
+
+  if (winner == -1) {
+    std::cout << "No first solution found in the race" << std::endl;
+    return TSPTWSolver(data, filename, &strategy);
+  }
+  std::cout << "Race winner : " << FirstSolutionStrategy::Value_Name(outcomes[winner].first_solution) << std::endl;
+  strategy.first_solution = outcomes[winner].first_solution;
+  strategy.initial_routes = &outcomes[winner].routes;
+  return TSPTWSolver(data, filename, &strategy);
+}
+
+//  Search strategies of the portfolio, the first one is the default search
+std::vector<SearchStrategy> PortfolioStrategies(int threads) {
+  const std::vector<FirstSolutionStrategy::Value> first_solutions = {
+    FirstSolutionStrategy::PARALLEL_CHEAPEST_INSERTION,
+    FirstSolutionStrategy::LOCAL_CHEAPEST_INSERTION,
+    FirstSolutionStrategy::PATH_CHEAPEST_ARC,
+    FirstSolutionStrategy::SAVINGS,
+    FirstSolutionStrategy::GLOBAL_CHEAPEST_ARC
+  };
+  const std::vector<LocalSearchMetaheuristic::Value> metaheuristics = {
+    LocalSearchMetaheuristic::TABU_SEARCH,
+    LocalSearchMetaheuristic::SIMULATED_ANNEALING,
+    LocalSearchMetaheuristic::GUIDED_LOCAL_SEARCH
+  };
+  std::vector<SearchStrategy> strategies;
+  strategies.push_back(SearchStrategy(0, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET));
+  for (int worker = 1; worker < threads; ++worker) {
+    strategies.push_back(SearchStrategy(worker, first_solutions[(worker - 1) % first_solutions.size()],
+                                        metaheuristics[(worker - 1) % metaheuristics.size()]));
+  }
+  return strategies;
+}
+
+//  Runs one independent model per thread over the same data. Each search
+//  publishes its improving solutions to the shared incumbent, whose result
+//  is written at the end.
+int PortfolioSolver(const TSPTWDataDT &data, std::string filename, int threads) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  SharedIncumbent incumbent;
+  const std::vector<SearchStrategy> strategies = PortfolioStrategies(threads);
+  std::vector<std::thread> workers;
+  for (const SearchStrategy& strategy : strategies) {
+    workers.push_back(std::thread([&data, &filename, &strategy, &incumbent]() {
+      TSPTWSolver(data, filename, &strategy, &incumbent);
+    }));
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  int status = 0;
+  if (incumbent.Worker() >= 0) {
+    std::cout << "Best worker : " << incumbent.Worker() << std::endl;
+    if (!WriteResultFile(incumbent.Result(), filename)) status = -1;
+  } else {
+    std::cout << "No solution found..." << std::endl;
+  }
+
+  return status;
+}
+
+//  Cost of the current routes of a sub-problem, then the best solution found
+//  from them. Returns true when it costs less.
+bool ImproveSubProblem(const ortools_vrp::Problem& sub, int worker, int64 time_limit_ms, SearchOutcome* current, SearchOutcome* outcome) {
+  TSPTWDataDT data(sub);
+  SearchStrategy evaluation(worker, FirstSolutionStrategy::ALL_UNPERFORMED, LocalSearchMetaheuristic::UNSET);
+  evaluation.first_solution_only = true;
+  TSPTWSolver(data, "", &evaluation, NULL, current);
+
+  SearchStrategy strategy(worker, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET);
+  strategy.time_limit_ms = time_limit_ms;
+  TSPTWSolver(data, "", &strategy, NULL, outcome);
+  return outcome->cost >= 0 && (current->cost < 0 || outcome->cost < current->cost);
+}
+
+//  Sub-problems weigh unperformed services on their own scale, so their
+//  costs don't add up. The merged routes are evaluated once on the whole
+//  problem instead, the cost is left as is if they can't be.
+void EvaluateResult(const ortools_vrp::Problem& problem, ortools_result::Result* result) {
+  ortools_vrp::Problem whole(problem);
+  std::vector<int> vehicles;
+  for (int v = 0; v < result->routes_size(); ++v) vehicles.push_back(v);
+  SetRoutesFromResult(*result, vehicles, &whole);
+
+  TSPTWDataDT data(whole);
+  SearchStrategy evaluation(0, FirstSolutionStrategy::ALL_UNPERFORMED, LocalSearchMetaheuristic::UNSET);
+  evaluation.first_solution_only = true;
+  SearchOutcome outcome;
+  TSPTWSolver(data, "", &evaluation, NULL, &outcome);
+  if (outcome.cost < 0) {
+    std::cout << "Failed to evaluate the merged routes" << std::endl;
+    return;
+  }
+  result->set_cost(outcome.result.cost());
+}
+
+//  POPMUSIC like improvement: a seed route and its closest routes are
+//  re-optimised together as a sub-problem, several disjoint subsets in
+//  parallel. Seeds are tried until none improves or the time is over, an
+//  improvement makes the routes of its subset seeds again. Returns the number
+//  of improvements, the cost of the result is left to the caller.
+int64 RouteSubsetImprovement(const ortools_vrp::Problem& problem, ortools_result::Result* result) {
+  const double start_time = base::GetCurrentTimeNanos();
+  const std::vector<ServiceGroup> groups = ServiceGroups(problem);
+  std::vector<int> service_group(problem.services_size());
+  for (int g = 0; g < groups.size(); ++g) {
+    for (int s: groups[g].services) service_group[s] = g;
+  }
+
+  const int size_vehicles = result->routes_size();
+  std::set<int> seeds;
+  for (int v = 0; v < size_vehicles; ++v) seeds.insert(v);
+  int64 rounds = 0;
+  int64 improvements = 0;
+  while (!seeds.empty() && 1e-6 * (base::GetCurrentTimeNanos() - start_time) < FLAGS_route_subset_improvement_time_in_ms) {
+    std::vector<int> route_of(problem.services_size(), -1);
+    std::vector<int32> locations(size_vehicles);
+    for (int v = 0; v < size_vehicles; ++v) {
+      for (const ortools_result::Activity& activity: result->routes(v).activities()) {
+        if (activity.type() == "service") route_of[activity.index()] = v;
+      }
+      locations[v] = RouteLocation(problem, result->routes(v), problem.vehicles(v));
+    }
+    // Unassigned services may join the subset of their closest route
+    std::vector<std::vector<int>> attached(size_vehicles);
+    for (int s = 0; s < problem.services_size(); ++s) {
+      if (route_of[s] != -1) continue;
+      int closest = 0;
+      for (int v = 1; v < size_vehicles; ++v) {
+        if (LocationTime(problem, problem.services(s).matrix_index(), locations[v]) < LocationTime(problem, problem.services(s).matrix_index(), locations[closest]))
+          closest = v;
+      }
+      attached[closest].push_back(s);
+    }
+
+    std::vector<bool> busy(size_vehicles, false);
+    std::vector<int> subset_seeds;
+    std::vector<std::vector<int>> subset_vehicles;
+    std::vector<std::vector<int>> subset_services;
+    for (int seed: seeds) {
+      if (subset_seeds.size() >= std::max(FLAGS_decomposition_threads, 1)) break;
+      if (busy[seed]) continue;
+      std::vector<std::pair<int64, int>> closest;
+      for (int v = 0; v < size_vehicles; ++v) {
+        if (v != seed && !busy[v]) closest.push_back(std::make_pair(LocationTime(problem, locations[seed], locations[v]), v));
+      }
+      const int others = std::min((int)closest.size(), std::max(FLAGS_route_subset_size - 1, 0));
+      std::partial_sort(closest.begin(), closest.begin() + others, closest.end());
+      std::vector<int> vehicles(1, seed);
+      for (int i = 0; i < others; ++i) vehicles.push_back(closest[i].second);
+
+      // Routes holding services related to the subset join it
+      std::set<int> vehicle_set(vehicles.begin(), vehicles.end());
+      std::set<int> services;
+      bool conflict = false;
+      for (int i = 0; i < vehicles.size() && !conflict; ++i) {
+        std::vector<int> members = attached[vehicles[i]];
+        for (const ortools_result::Activity& activity: result->routes(vehicles[i]).activities()) {
+          if (activity.type() == "service") members.push_back(activity.index());
+        }
+        for (int s: members) {
+          for (int related: groups[service_group[s]].services) {
+            services.insert(related);
+            const int v = route_of[related];
+            if (v == -1 || vehicle_set.count(v) > 0) continue;
+            if (busy[v]) conflict = true;
+            vehicle_set.insert(v);
+            vehicles.push_back(v);
+          }
+        }
+      }
+      if (conflict) continue;
+      for (int v: vehicles) busy[v] = true;
+      subset_seeds.push_back(seed);
+      subset_vehicles.push_back(vehicles);
+      subset_services.push_back(std::vector<int>(services.begin(), services.end()));
+    }
+    if (subset_seeds.empty()) break;
+
+    const int subsets = subset_seeds.size();
+    std::vector<ortools_vrp::Problem> subs(subsets);
+    std::vector<std::vector<int>> service_maps(subsets);
+    for (int k = 0; k < subsets; ++k) {
+      subs[k] = SubProblem(problem, subset_services[k], subset_vehicles[k], &service_maps[k]);
+      SetRoutesFromResult(*result, subset_vehicles[k], &subs[k]);
+    }
+    std::vector<SearchOutcome> currents(subsets);
+    std::vector<SearchOutcome> outcomes(subsets);
+    std::vector<char> improved(subsets, false);
+    ParallelFor(subsets, FLAGS_decomposition_threads, [&subs, &currents, &outcomes, &improved](int k) {
+      improved[k] = ImproveSubProblem(subs[k], k, FLAGS_route_subset_time_in_ms, &currents[k], &outcomes[k]);
+    });
+    for (int k = 0; k < subsets; ++k) {
+      seeds.erase(subset_seeds[k]);
+      if (!improved[k]) continue;
+      MergeSubResult(problem, outcomes[k].result, service_maps[k], subset_vehicles[k], result);
+      seeds.insert(subset_vehicles[k].begin(), subset_vehicles[k].end());
+      ++improvements;
+    }
+    ++rounds;
+    if (FLAGS_debug) std::cout << "Route subsets round : " << rounds << " Improvements : " << improvements << std::endl;
+  }
+  std::cout << "Route subsets rounds : " << rounds << " Improvements : " << improvements << std::endl;
+  return improvements;
+}
+
+int WriteResult(ortools_result::Result& result, std::string filename, double start_time) {
+  result.set_duration(1e-9 * (base::GetCurrentTimeNanos() - start_time));
+
+  const int status = WriteResultFile(result, filename) ? 0 : -1;
+  std::cout << "Final Cost : " << result.cost() << " Time : " << result.duration() << std::endl;
+  return status;
+}
+
+//  Splits the problem into clusters of services with their own vehicles,
+//  solved in parallel as independent models and merged. Neighbouring
+//  clusters are then re-optimised by pairs across their boundary.
+int DecompositionSolver(const std::string& instance, std::string filename) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  const double start_time = base::GetCurrentTimeNanos();
+
+  ortools_vrp::Problem problem;
+  if (!ReadProblem(instance, &problem)) {
+    std::cout << "Failed to parse pbf." << std::endl;
+    return -1;
+  }
+
+  const Decomposition decomposition = ClusterProblem(problem, FLAGS_decomposition_cluster_size > 0 ? FLAGS_decomposition_cluster_size : std::max(problem.services_size(), 1));
+  const int clusters = decomposition.services.size();
+  if (clusters == 1) {
+    TSPTWDataDT data(problem);
+    if (FLAGS_route_subset_improvement_time_in_ms <= 0) return TSPTWSolver(data, filename);
+    SearchOutcome outcome;
+    TSPTWSolver(data, "", NULL, NULL, &outcome);
+    if (outcome.cost < 0) {
+      std::cout << "No solution found..." << std::endl;
+      return 0;
+    }
+    ortools_result::Result result = outcome.result;
+    if (RouteSubsetImprovement(problem, &result) > 0) EvaluateResult(problem, &result);
+    return WriteResult(result, filename, start_time);
+  }
+  std::cout << "Clusters : " << clusters << std::endl;
+
+  std::vector<ortools_vrp::Problem> subs(clusters);
+  std::vector<std::vector<int>> service_maps(clusters);
+  for (int c = 0; c < clusters; ++c) {
+    subs[c] = SubProblem(problem, decomposition.services[c], decomposition.vehicles[c], &service_maps[c]);
+  }
+  std::vector<SearchOutcome> outcomes(clusters);
+  ParallelFor(clusters, FLAGS_decomposition_threads, [&subs, &outcomes](int c) {
+    if (subs[c].services_size() == 0) return;
+    TSPTWDataDT data(subs[c]);
+    SearchStrategy strategy(c, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET);
+    TSPTWSolver(data, "", &strategy, NULL, &outcomes[c]);
+  });
+
+  ortools_result::Result result = EmptyResult(problem);
+  for (int c = 0; c < clusters; ++c) {
+    if (outcomes[c].cost < 0) {
+      if (subs[c].services_size() > 0) std::cout << "No solution found for cluster " << c << std::endl;
+      continue;
+    }
+    MergeSubResult(problem, outcomes[c].result, service_maps[c], decomposition.vehicles[c], &result);
+    result.set_iterations(result.iterations() + outcomes[c].result.iterations());
+  }
+
+  if (FLAGS_boundary_improvement_time_in_ms > 0) {
+    const std::vector<std::pair<int, int>> pairs = NeighbourPairs(problem, decomposition);
+    std::vector<ortools_vrp::Problem> pair_subs(pairs.size());
+    std::vector<std::vector<int>> pair_maps(pairs.size());
+    std::vector<std::vector<int>> pair_vehicles(pairs.size());
+    for (int p = 0; p < pairs.size(); ++p) {
+      std::vector<int> services = decomposition.services[pairs[p].first];
+      services.insert(services.end(), decomposition.services[pairs[p].second].begin(), decomposition.services[pairs[p].second].end());
+      pair_vehicles[p] = decomposition.vehicles[pairs[p].first];
+      pair_vehicles[p].insert(pair_vehicles[p].end(), decomposition.vehicles[pairs[p].second].begin(), decomposition.vehicles[pairs[p].second].end());
+      pair_subs[p] = SubProblem(problem, services, pair_vehicles[p], &pair_maps[p]);
+      SetRoutesFromResult(result, pair_vehicles[p], &pair_subs[p]);
+    }
+    std::vector<SearchOutcome> currents(pairs.size());
+    std::vector<SearchOutcome> improvements(pairs.size());
+    std::vector<char> improved(pairs.size(), false);
+    ParallelFor(pairs.size(), FLAGS_decomposition_threads, [&pair_subs, &currents, &improvements, &improved](int p) {
+      improved[p] = ImproveSubProblem(pair_subs[p], p, FLAGS_boundary_improvement_time_in_ms, &currents[p], &improvements[p]);
+    });
+    for (int p = 0; p < pairs.size(); ++p) {
+      if (!improved[p]) continue;
+      std::cout << "Clusters " << pairs[p].first << " and " << pairs[p].second << " improved from " << currents[p].result.cost() << " to " << improvements[p].result.cost() << std::endl;
+      MergeSubResult(problem, improvements[p].result, pair_maps[p], pair_vehicles[p], &result);
+    }
+  }
+  if (FLAGS_route_subset_improvement_time_in_ms > 0) RouteSubsetImprovement(problem, &result);
+  EvaluateResult(problem, &result);
+  return WriteResult(result, filename, start_time);
+}
+
+//  Multi-day problems: services are given a day first, within the day
+//  lapses of their relations, then the days are solved in parallel, each
+//  with its own vehicles. Repair rounds move the groups a day left out to
+//  another day and re-optimise the days changed from their current routes.
+//  Services following a left out one in a day lapse are taken out as well.
+int DaySolver(const std::string& instance, std::string filename) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  const double start_time = base::GetCurrentTimeNanos();
+
+  ortools_vrp::Problem problem;
+  if (!ReadProblem(instance, &problem)) {
+    std::cout << "Failed to parse pbf." << std::endl;
+    return -1;
+  }
+
+  const std::vector<ServiceGroup> groups = ServiceGroups(problem, false);
+  std::vector<int> service_group(problem.services_size());
+  for (int g = 0; g < groups.size(); ++g) {
+    for (int s: groups[g].services) service_group[s] = g;
+  }
+  const std::vector<DayLapse> lapses = DayLapses(problem);
+  DayDecomposition decomposition = DayProblem(problem, groups, lapses);
+  const int size_days = decomposition.days.size();
+  if (size_days <= 1) {
+    TSPTWDataDT data(problem);
+    return TSPTWSolver(data, filename);
+  }
+  std::cout << "Days : " << size_days << " Left out : " << decomposition.left_out.size() << std::endl;
+
+  std::vector<int> service_position(problem.services_size(), -1);
+  for (int d = 0; d < size_days; ++d) {
+    for (int s: decomposition.services[d]) service_position[s] = d;
+  }
+  std::vector<ortools_vrp::Problem> subs(size_days);
+  std::vector<std::vector<int>> service_maps(size_days);
+  for (int d = 0; d < size_days; ++d) {
+    subs[d] = SubProblem(problem, decomposition.services[d], decomposition.vehicles[d], &service_maps[d]);
+  }
+  std::vector<SearchOutcome> outcomes(size_days);
+  ParallelFor(size_days, FLAGS_decomposition_threads, [&subs, &outcomes](int d) {
+    if (subs[d].services_size() == 0) return;
+    TSPTWDataDT data(subs[d]);
+    SearchStrategy strategy(d, FirstSolutionStrategy::UNSET, LocalSearchMetaheuristic::UNSET);
+    TSPTWSolver(data, "", &strategy, NULL, &outcomes[d]);
+  });
+
+  ortools_result::Result result = EmptyResult(problem);
+  for (int d = 0; d < size_days; ++d) {
+    if (outcomes[d].cost < 0) {
+      if (subs[d].services_size() > 0) std::cout << "No solution found for day " << decomposition.days[d] << std::endl;
+      continue;
+    }
+    MergeSubResult(problem, outcomes[d].result, service_maps[d], decomposition.vehicles[d], &result);
+    result.set_iterations(result.iterations() + outcomes[d].result.iterations());
+  }
+
+  std::vector<std::set<int>> tried(groups.size());
+  for (int round = 0; ; ++round) {
+    std::vector<bool> kept(problem.services_size(), false);
+    for (const ortools_result::Route& route: result.routes()) {
+      for (const ortools_result::Activity& activity: route.activities()) {
+        if (activity.type() == "service") kept[activity.index()] = true;
+      }
+    }
+
+    // Groups served after a left out service of their day lapses go out
+    std::vector<bool> changed(size_days, false);
+    for (bool removed = true; removed; ) {
+      removed = false;
+      for (const DayLapse& link: lapses) {
+        if (kept[link.previous] || !kept[link.next]) continue;
+        for (int s: groups[service_group[link.next]].services) {
+          kept[s] = false;
+          if (service_position[s] == -1) continue;
+          std::vector<int>& services = decomposition.services[service_position[s]];
+          services.erase(std::find(services.begin(), services.end(), s));
+          changed[service_position[s]] = true;
+          service_position[s] = -1;
+        }
+        removed = true;
+      }
+    }
+
+    // Left out groups move to the least loaded day allowed not tried yet
+    int moved = 0;
+    if (round < FLAGS_day_repair_iterations) {
+      std::vector<int32> service_day(problem.services_size(), -2);
+      for (int s = 0; s < problem.services_size(); ++s) {
+        if (kept[s]) service_day[s] = decomposition.days[service_position[s]];
+      }
+      for (int g = 0; g < groups.size(); ++g) {
+        const ServiceGroup& group = groups[g];
+        if (std::any_of(group.services.begin(), group.services.end(), [&kept](int s) { return kept[s]; })) continue;
+        const int position = service_position[group.services[0]];
+        if (position != -1) tried[g].insert(position);
+        int32 first = decomposition.days.front();
+        int32 last = decomposition.days.back();
+        bool allowed = true;
+        for (int s: group.services) {
+          first = std::max(first, decomposition.first[s]);
+          last = std::min(last, decomposition.last[s]);
+          allowed = allowed && LapseRange(lapses, service_day, s, &first, &last);
+        }
+        if (!allowed) continue;
+        int best = -1;
+        double lightest = -1;
+        for (int d: decomposition.group_days[g]) {
+          if (tried[g].count(d) > 0 || decomposition.days[d] < first || decomposition.days[d] > last) continue;
+          const double load = (double)decomposition.services[d].size() / decomposition.vehicles[d].size();
+          if (best == -1 || load < lightest) {
+            lightest = load;
+            best = d;
+          }
+        }
+        if (best == -1) continue;
+        tried[g].insert(best);
+        for (int s: group.services) {
+          if (position != -1) {
+            std::vector<int>& services = decomposition.services[position];
+            services.erase(std::find(services.begin(), services.end(), s));
+            changed[position] = true;
+          }
+          decomposition.services[best].push_back(s);
+          service_position[s] = best;
+          service_day[s] = decomposition.days[best];
+        }
+        changed[best] = true;
+        ++moved;
+      }
+    }
+
+    std::vector<int> days;
+    for (int d = 0; d < size_days; ++d) {
+      if (changed[d]) days.push_back(d);
+    }
+    if (days.empty()) break;
+    for (int d: days) {
+      std::sort(decomposition.services[d].begin(), decomposition.services[d].end());
+      subs[d] = SubProblem(problem, decomposition.services[d], decomposition.vehicles[d], &service_maps[d]);
+      SetRoutesFromResult(result, decomposition.vehicles[d], &subs[d]);
+    }
+    std::vector<SearchOutcome> currents(days.size());
+    std::vector<SearchOutcome> repairs(days.size());
+    std::vector<char> improved(days.size(), false);
+    ParallelFor(days.size(), FLAGS_decomposition_threads, [&days, &subs, &currents, &repairs, &improved](int k) {
+      improved[k] = ImproveSubProblem(subs[days[k]], k, FLAGS_day_repair_time_in_ms, &currents[k], &repairs[k]);
+    });
+    for (int k = 0; k < days.size(); ++k) {
+      const int d = days[k];
+      const SearchOutcome& chosen = improved[k] ? repairs[k] : currents[k];
+      if (chosen.cost < 0) {
+        std::cout << "No solution found for day " << decomposition.days[d] << std::endl;
+        continue;
+      }
+      MergeSubResult(problem, chosen.result, service_maps[d], decomposition.vehicles[d], &result);
+    }
+    std::cout << "Day repair round : " << round + 1 << " Moved : " << moved << std::endl;
+  }
+  EvaluateResult(problem, &result);
+  return WriteResult(result, filename, start_time);
+}
+
+//  Solves the problem once, or starts from a previous result, then applies
+//  the updates read from stdin as they come. Each update builds a new model
+//  of what is left of the routes: started services stay frozen, the
+//  remaining ones are locked in place while cheapest insertion adds the new
+//  ones, followed by a short local search. Nothing but the problem and the
+//  current routes is kept from one update to the next. The result is
+//  written after every update.
+int RedispatchSolver(const std::string& instance, std::string filename) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  ortools_vrp::Problem problem;
+  if (!ReadProblem(instance, &problem)) {
+    std::cout << "Failed to parse pbf." << std::endl;
+    return -1;
+  }
+
+  ortools_result::Result result;
+  if (!FLAGS_previous_result_file.empty()) {
+    std::fstream input(FLAGS_previous_result_file, std::ios::in | std::ios::binary);
+    if (!result.ParseFromIstream(&input)) {
+      std::cout << "Failed to parse previous result." << std::endl;
+      return -1;
+    }
+  } else {
+    TSPTWDataDT data(problem);
+    SearchOutcome outcome;
+    TSPTWSolver(data, "", NULL, NULL, &outcome);
+    if (outcome.cost < 0) {
+      std::cout << "No solution found..." << std::endl;
+      return 0;
+    }
+    result = outcome.result;
+  }
+  int status = WriteResult(result, filename, base::GetCurrentTimeNanos());
+
+  google::protobuf::io::FileInputStream stdin_stream(0);
+  ortools_vrp::Update update;
+  int64 updates = 0;
+  while (status == 0 && ReadDelimited(&stdin_stream, &update)) {
+    const double start_time = base::GetCurrentTimeNanos();
+    ApplyUpdate(update, &problem);
+    std::vector<int> service_map;
+    std::vector<ortools_result::Route> frozen;
+    const ortools_vrp::Problem sub = DispatchProblem(problem, result, update.time(), &service_map, &frozen);
+
+    TSPTWDataDT data(sub);
+    SearchStrategy strategy(0, FirstSolutionStrategy::LOCAL_CHEAPEST_INSERTION, LocalSearchMetaheuristic::UNSET);
+    strategy.time_limit_ms = FLAGS_redispatch_time_in_ms;
+    SearchOutcome outcome;
+    TSPTWSolver(data, "", &strategy, NULL, &outcome);
+    ++updates;
+    if (outcome.cost < 0) {
+      std::cout << "Update : " << updates << " No solution found" << std::endl;
+      continue;
+    }
+    result = MergeDispatch(problem, outcome.result, service_map, frozen);
+    EvaluateResult(problem, &result);
+    std::cout << "Update : " << updates << " New : " << update.services_size() << " Cancelled : " << update.cancelled_ids_size() << " Time : " << 1e-6 * (base::GetCurrentTimeNanos() - start_time) << " ms" << std::endl;
+    status = WriteResult(result, filename, start_time);
+    update.Clear();
+  }
+
+  return status;
+}
+
+//  Solves the instance with the mode chosen by the flags
+int Solve(const std::string& instance, std::string filename) {
+  if (FLAGS_redispatch)
+    return RedispatchSolver(instance, filename);
+  if (FLAGS_day_decomposition)
+    return DaySolver(instance, filename);
+  if (FLAGS_decomposition_cluster_size > 0 || FLAGS_route_subset_improvement_time_in_ms > 0)
+    return DecompositionSolver(instance, filename);
+  // Shared with the lower bound thread, which may outlive the search
+  const std::shared_ptr<const TSPTWDataDT> data = std::make_shared<const TSPTWDataDT>(instance);
+  if (FLAGS_lower_bound || FLAGS_stop_gap > 0)
+    StartObjectiveLowerBound(data, DisjunctionPenalties(*data, data->Size() - 2), FLAGS_lower_bound_max_nodes);
+  const TSPTWDataDT &tsptw_data = *data;
+  if (FLAGS_portfolio_threads > 1)
+    return PortfolioSolver(tsptw_data, filename, FLAGS_portfolio_threads);
+  if (FLAGS_first_solution_racing)
+    return RacingSolver(tsptw_data, filename);
+  if (!FLAGS_previous_result_file.empty())
+    return WarmStartSolver(tsptw_data, filename, FLAGS_previous_result_file);
+  return TSPTWSolver(tsptw_data, filename);
+}
+
 } // namespace operations_research
 
 int main(int argc, char **argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  if(FLAGS_time_limit_in_ms > 0 || FLAGS_no_solution_improvement_limit > 0) {
-    operations_research::TSPTWDataDT tsptw_data(FLAGS_instance_file);
-    return operations_research::TSPTWSolver(tsptw_data, FLAGS_solution_file);
+  if (FLAGS_pipe) {
+    if (FLAGS_redispatch) {
+      std::cerr << "Pipe mode reads the problem from stdin, updates cannot follow" << std::endl;
+      return -1;
+    }
+    // Results are streamed on stdout, logs go to stderr
+    FLAGS_instance_file = "-";
+    FLAGS_solution_file = "-";
+    FLAGS_intermediate_solutions = true;
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
+
+  int status = 0;
+  if(FLAGS_time_limit_in_ms > 0 || FLAGS_no_solution_improvement_limit > 0 || FLAGS_stop_wall_time_in_ms > 0 ||
+     FLAGS_stop_plateau_in_ms > 0 || FLAGS_stop_improvement_window_in_ms > 0 || FLAGS_stop_solution_limit > 0) {
+    status = operations_research::Solve(FLAGS_instance_file, FLAGS_solution_file);
   } else {
     std::cout << "No Stop condition" << std::endl;
   }
+  // The stream ends with an empty frame, also when nothing was solved
+  if (FLAGS_pipe) operations_research::WriteResultFrame(NULL);
 
-  return 0;
+  // Every result, up to the end frame, is written before protobuf goes away
+  google::protobuf::ShutdownProtobufLibrary();
+  return status;
 }
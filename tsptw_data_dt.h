@@ -1,31 +1,51 @@
 #ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_TSPTW_DATA_DT_H
 #define OR_TOOLS_TUTORIALS_CPLUSPLUS_TSPTW_DATA_DT_H
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <iomanip>
+#include <set>
 #include <vector>
 
+#include "ortools/base/commandlineflags.h"
 #include "ortools/constraint_solver/routing.h"
 #include "ortools/base/filelinereader.h"
 #include "ortools/base/split.h"
 #include "ortools/base/strtoint.h"
 
 
+#include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "ortools_vrp.pb.h"
 #include "routing_common/routing_common.h"
 
 #define CUSTOM_MAX_INT (int64)std::pow(2,30)
 
+DEFINE_bool(sequence_contraction, true, "Contract sequence relations into a single node");
+DEFINE_bool(unserviceable_presolve, true, "Leave out services which no vehicle can serve");
+DEFINE_bool(colocated_aggregation, false, "Aggregate services sharing a matrix index into a single node");
+DEFINE_int32(aggregation_max_services, 0, "Maximum number of services in an aggregated node, 0 means no limit");
+DEFINE_int64(aggregation_max_duration, 0, "Maximum duration of an aggregated node, 0 means no limit");
+
 enum RelationType { ForceFirst = 9, NeverFirst = 8, MaximumDurationLapse = 7, MeetUp = 6, Shipment = 5, MaximumDayLapse = 4, MinimumDayLapse = 3, SameRoute = 2, Order = 1, Sequence = 0 };
 
 namespace operations_research {
 
 class TSPTWDataDT {
 public:
-  explicit TSPTWDataDT(std::string filename) {
+  explicit TSPTWDataDT(std::string filename) :
+    lower_bound_(std::make_shared<std::atomic<int64>>(kint64min)) {
     LoadInstance(filename);
   }
+  explicit TSPTWDataDT(const ortools_vrp::Problem& problem) :
+    lower_bound_(std::make_shared<std::atomic<int64>>(kint64min)) {
+    LoadProblem(problem);
+  }
   void LoadInstance(const std::string & filename);
+  void LoadProblem(const ortools_vrp::Problem& problem);
 
   //  Helper function
   int64& SetMatrix(int i, int j) {
@@ -179,6 +199,24 @@ public:
     return tsptw_clients_[i.value()].vehicle_indices;
   }
 
+  int64 ServiceDistance(RoutingModel::NodeIndex i)  const {
+    return tsptw_clients_[i.value()].service_distance;
+  }
+
+  //  Services contracted into node i, empty unless several services share it
+  const std::vector<int32>& SequenceMembers(RoutingModel::NodeIndex i) const {
+    return tsptw_clients_[i.value()].sequence_members;
+  }
+
+  const std::vector<std::string>& SequenceIds(RoutingModel::NodeIndex i) const {
+    return tsptw_clients_[i.value()].sequence_ids;
+  }
+
+  //  Start time of each contracted service relative to the node start time
+  const std::vector<int64>& SequenceOffsets(RoutingModel::NodeIndex i) const {
+    return tsptw_clients_[i.value()].sequence_offsets;
+  }
+
   int32 TimeWindowsSize(int i) const {
     return tws_size_.at(i);
   }
@@ -217,9 +255,18 @@ public:
     return tsptw_clients_[i.value()].quantities;
   }
 
+  //  Whether any service loads or unloads the unit i
+  bool QuantityUsed(int64 i) const {
+    for (const TSPTWClient& client: tsptw_clients_) {
+      if (i < client.quantities.size() && client.quantities.at(i) != 0) return true;
+      if (i < client.setup_quantities.size() && client.setup_quantities.at(i) != 0) return true;
+    }
+    return false;
+  }
+
   struct Vehicle {
     Vehicle(TSPTWDataDT* data_, int32 size_):
-    data(data_), size(size_), capacity(0), overload_multiplier(0), break_size(0), time_start(0), time_end(0), late_multiplier(0), problem_matrix_index(0), value_matrix_index(0), vehicle_indices(0){
+    data(data_), size(size_), capacity(0), overload_multiplier(0), break_size(0), time_start(0), time_end(0), late_multiplier(0), problem_matrix_index(0), value_matrix_index(0), vehicle_indices(0), vehicle_out_indices(0){
     }
 
     int32 SizeMatrix() const {
@@ -243,44 +290,44 @@ public:
     int64 Distance(RoutingModel::NodeIndex i, RoutingModel::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
-      if (max_ride_distance_ > 0 && data->distances_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      if (vehicle_out_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
+      if (max_ride_distance_ > 0 && data->distances_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()])) > max_ride_distance_) return CUSTOM_MAX_INT;
-      return data->distances_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      return data->distances_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()]));
     }
 
     int64 Time(RoutingModel::NodeIndex i, RoutingModel::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
-      if (max_ride_time_ > 0 && data->times_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      if (vehicle_out_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
+      if (max_ride_time_ > 0 && data->times_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()])) > max_ride_time_) return CUSTOM_MAX_INT;
-      return data->times_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      return data->times_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()]));
     }
 
     int64 Value(RoutingModel::NodeIndex i, RoutingModel::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
-      return data->values_matrices_.at(value_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      if (vehicle_out_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
+      return data->values_matrices_.at(value_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()]));
     }
 
     int64 TimeOrder(RoutingModel::NodeIndex i, RoutingModel::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
-      return 10 * std::sqrt(data->times_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      if (vehicle_out_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
+      return 10 * std::sqrt(data->times_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()])));
     }
 
     int64 DistanceOrder(RoutingModel::NodeIndex i, RoutingModel::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
-      return 100 * std::sqrt(data->distances_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_indices[i.value()]),
+      if (vehicle_out_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1) return 0;
+      return 100 * std::sqrt(data->distances_matrices_.at(problem_matrix_index)->Cost(RoutingModel::NodeIndex(vehicle_out_indices[i.value()]),
         RoutingModel::NodeIndex(vehicle_indices[j.value()])));
     }
 
@@ -290,6 +337,12 @@ public:
       return Distance(from, to) + data->ServiceTime(from);
     }
 
+    //  Transit quantity at a node "from"
+    //  This is the distance travelled inside node "from" plus the one to node "to"
+    int64 DistancePlusServiceDistance(RoutingModel::NodeIndex from, RoutingModel::NodeIndex to) const {
+      return Distance(from, to) + data->ServiceDistance(from);
+    }
+
     //  Transit quantity at a node "from"
     //  This is the quantity added after visiting node "from"
     int64 TimePlusServiceTime(RoutingModel::NodeIndex from, RoutingModel::NodeIndex to) const {
@@ -304,6 +357,32 @@ public:
       return Time(from, to);
     }
 
+    //  Specialised transits, instantiated for the features of the instance
+    //  so the unused branches and checks are compiled out.
+    template <bool kRideLimit, bool kSetup>
+    int64 FastTimePlusServiceTime(RoutingModel::NodeIndex from, RoutingModel::NodeIndex to) const {
+      const int64 i = vehicle_out_indices[from.value()];
+      const int64 j = vehicle_indices[to.value()];
+      int64 time = 0;
+      if (i != -1 && j != -1) {
+        time = data->times_matrices_[problem_matrix_index]->Cost(RoutingModel::NodeIndex(i), RoutingModel::NodeIndex(j));
+        if (kRideLimit && max_ride_time_ > 0 && time > max_ride_time_) time = CUSTOM_MAX_INT;
+      }
+      return time + data->tsptw_clients_[from.value()].service_time + (kSetup && time > 0 ? data->tsptw_clients_[from.value()].setup_time : 0);
+    }
+
+    template <bool kRideLimit, bool kServiceDistance>
+    int64 FastDistancePlusServiceDistance(RoutingModel::NodeIndex from, RoutingModel::NodeIndex to) const {
+      const int64 i = vehicle_out_indices[from.value()];
+      const int64 j = vehicle_indices[to.value()];
+      int64 distance = 0;
+      if (i != -1 && j != -1) {
+        distance = data->distances_matrices_[problem_matrix_index]->Cost(RoutingModel::NodeIndex(i), RoutingModel::NodeIndex(j));
+        if (kRideLimit && max_ride_distance_ > 0 && distance > max_ride_distance_) distance = CUSTOM_MAX_INT;
+      }
+      return kServiceDistance ? distance + data->tsptw_clients_[from.value()].service_distance : distance;
+    }
+
     RoutingModel::NodeIndex Start() const {
       return start;
     }
@@ -327,6 +406,7 @@ public:
     int64 problem_matrix_index;
     int64 value_matrix_index;
     std::vector<int64> vehicle_indices;
+    std::vector<int64> vehicle_out_indices;
     std::vector<int64> capacity;
     std::vector<bool> counting;
     std::vector<int64> overload_multiplier;
@@ -350,6 +430,20 @@ public:
     return tsptw_vehicles_;
   }
 
+  bool HasSetupTimes() const {
+    for (const TSPTWClient& client: tsptw_clients_) {
+      if (client.setup_time > 0) return true;
+    }
+    return false;
+  }
+
+  bool HasServiceDistances() const {
+    for (const TSPTWClient& client: tsptw_clients_) {
+      if (client.service_distance > 0) return true;
+    }
+    return false;
+  }
+
   struct Route {
     Route(std::string v_id):
       vehicle_id(v_id), vehicle_index(-1){}
@@ -364,6 +458,12 @@ public:
     return tsptw_routes_;
   }
 
+  //  Lower bound of the objective shared by every search over this data,
+  //  kint64min until it is known
+  const std::shared_ptr<std::atomic<int64>>& LowerBound() const {
+    return lower_bound_;
+  }
+
   struct Rest {
     Rest(int rest_no):
         rest_number(rest_no), rest_start(0), rest_end(0), rest_duration(0), vehicle(0){}
@@ -401,6 +501,11 @@ public:
     return vehicles_day_;
   }
 
+  //  Services left out of the model as no vehicle can serve them
+  std::vector<std::string> UnserviceableIds() const {
+    return unserviceable_ids_;
+  }
+
   int VehicleDay(int64 index) const {
     if (index < 0) {
       return -1;
@@ -408,6 +513,25 @@ public:
     return vehicles_day_.at(index);
   }
 
+  //  Arcs no vehicle can use, as node numbers
+  struct ArcElimination {
+    ArcElimination():
+      removed_arcs(0){}
+    //  Successors removed from each service node
+    std::vector<std::vector<int32>> removed_next;
+    //  Service nodes each vehicle can neither reach from its start nor
+    //  leave for its end in time
+    std::vector<std::vector<int32>> unreachable;
+    int64 removed_arcs;
+  };
+
+  //  Computed on the first call and shared by every model built on this
+  //  data, whose horizon is the same for all of them
+  const ArcElimination& EliminatedArcs(int64 horizon) const {
+    std::call_once(arc_elimination_once_, [this, horizon]() { ComputeArcElimination(horizon); });
+    return arc_elimination_;
+  }
+
 /*
   Vehicle VehicleGet(int64 v) const {
     return tsptw_vehicles_.at(v);
@@ -416,9 +540,38 @@ public:
 private:
   void ProcessNewLine(char* const line);
 
+  //  Chain of services to be replaced by a single node
+  struct SequenceChain {
+    SequenceChain():
+    ready_time(-CUSTOM_MAX_INT), due_time(CUSTOM_MAX_INT), service_time(0), service_value(0), service_distance(0), setup_time(0), priority(4), exclusion_cost(0){
+    }
+    std::vector<int32> members;
+    std::vector<int64> offsets;
+    int64 ready_time;
+    int64 due_time;
+    int64 service_time;
+    int64 service_value;
+    int64 service_distance;
+    int64 setup_time;
+    int32 priority;
+    int64 exclusion_cost;
+    std::vector<int64> vehicle_indices;
+    std::vector<int64> quantities;
+  };
+
+  void PrepareContraction(const ortools_vrp::Problem& problem);
+  bool ContractibleService(const ortools_vrp::Service& service) const;
+  bool BuildSequenceChain(const ortools_vrp::Problem& problem, SequenceChain* chain) const;
+  void AddSequenceChain(const SequenceChain& chain);
+  void PrepareSequenceContraction(const ortools_vrp::Problem& problem);
+  void PrepareColocatedAggregation(const ortools_vrp::Problem& problem);
+  bool NodeServiceable(RoutingModel::NodeIndex i) const;
+  void RemoveUnserviceableServices();
+  void ComputeArcElimination(int64 horizon) const;
+
   struct TSPTWClient {
     TSPTWClient(std::string cust_id, int32 m_i):
-    customer_id(cust_id), matrix_index(m_i), ready_time({-CUSTOM_MAX_INT}), due_time({CUSTOM_MAX_INT}), service_time(0.0), service_value(0.0), setup_time(0.0), priority(4), late_multiplier(0){
+    customer_id(cust_id), matrix_index(m_i), ready_time({-CUSTOM_MAX_INT}), due_time({CUSTOM_MAX_INT}), service_time(0.0), service_value(0.0), setup_time(0.0), priority(4), late_multiplier(0), service_distance(0){
     }
     TSPTWClient(std::string cust_id, int32 m_i, std::vector<int64> r_t, std::vector<int64> d_t):
     customer_id(cust_id), matrix_index(m_i), ready_time(r_t), due_time(d_t), service_time(0.0), service_value(0.0), setup_time(0.0), priority(4), late_multiplier(0){
@@ -439,7 +592,7 @@ private:
     customer_id(cust_id), matrix_index(m_i), ready_time(r_t), due_time(d_t), service_time(s_t), service_value(0.0), setup_time(st_t), priority(p_t), late_multiplier(l_m), vehicle_indices(v_i), quantities(q){
     }
     TSPTWClient(std::string cust_id, int32 m_i, std::vector<int64> r_t, std::vector<int64> d_t, double s_t, double s_v, double st_t, int32 p_t, double l_m, std::vector<int64>& v_i, std::vector<int64>& q, std::vector<int64>& s_q, int64 e_c, std::vector<bool>& r_q):
-    customer_id(cust_id), matrix_index(m_i), ready_time(r_t), due_time(d_t), service_time(s_t), service_value(s_v), setup_time(st_t), priority(p_t), late_multiplier(l_m), vehicle_indices(v_i), quantities(q), setup_quantities(s_q), exclusion_cost(e_c), refill_quantities(r_q){
+    customer_id(cust_id), matrix_index(m_i), ready_time(r_t), due_time(d_t), service_time(s_t), service_value(s_v), setup_time(st_t), priority(p_t), late_multiplier(l_m), vehicle_indices(v_i), quantities(q), setup_quantities(s_q), exclusion_cost(e_c), refill_quantities(r_q), service_distance(0){
     }
     std::string customer_id;
     int32 matrix_index;
@@ -455,6 +608,10 @@ private:
     std::vector<int64> setup_quantities;
     int64 exclusion_cost;
     std::vector<bool> refill_quantities;
+    int64 service_distance;
+    std::vector<int32> sequence_members;
+    std::vector<std::string> sequence_ids;
+    std::vector<int64> sequence_offsets;
   };
 
   int32 size_;
@@ -485,20 +642,40 @@ private:
   int64 deliveries_counter_;
   int64 multiple_tws_counter_;
   std::map<std::string, int64> ids_map_;
+  std::vector<SequenceChain> sequence_chains_;
+  std::map<int32, int32> sequence_heads_;
+  std::set<int32> sequence_tails_;
+  std::set<int32> contracted_relations_;
+  std::vector<std::string> unserviceable_ids_;
+  std::shared_ptr<std::atomic<int64>> lower_bound_;
+  mutable std::once_flag arc_elimination_once_;
+  mutable ArcElimination arc_elimination_;
 };
 
+//  Reads the problem from the file, or from stdin when the file is "-"
+bool ReadProblem(const std::string& filename, ortools_vrp::Problem* problem) {
+  if (filename == "-") {
+    google::protobuf::io::FileInputStream input(0);
+    return problem->ParseFromZeroCopyStream(&input);
+  }
+  std::fstream input(filename, std::ios::in | std::ios::binary);
+  return problem->ParseFromIstream(&input);
+}
+
 void TSPTWDataDT::LoadInstance(const std::string & filename) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
 
   ortools_vrp::Problem problem;
-
-  {
-    std::fstream input(filename, std::ios::in | std::ios::binary);
-    if (!problem.ParseFromIstream(&input)) {
-      VLOG(0) << "Failed to parse pbf." << std::endl;
-    }
+  if (!ReadProblem(filename, &problem)) {
+    VLOG(0) << "Failed to parse pbf." << std::endl;
   }
 
+  LoadProblem(problem);
+}
+
+void TSPTWDataDT::LoadProblem(const ortools_vrp::Problem& problem) {
+  PrepareContraction(problem);
+
   int s = 0;
   tws_counter_ = 0;
   multiple_tws_counter_ = 0;
@@ -506,6 +683,8 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
   int32 problem_index = 0;
   order_counter_ = 0;
   std::vector<int64> matrix_indices;
+  std::vector<int64> out_matrix_indices;
+  int32 services_counter = 0;
   for (const ortools_vrp::Service& service: problem.services()) {
     const int32 tws_size = service.time_windows_size();
     tws_size_.push_back(tws_size);
@@ -548,9 +727,48 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
 
     int timewindow_index = 0;
 
-    if (service.late_multiplier() > 0) {
+    std::map<int32, int32>::const_iterator head = sequence_heads_.find(problem_index);
+    if (sequence_tails_.count(problem_index) > 0) {
+      // Already part of the node built at the head of its sequence
+      ++problem_index;
+      continue;
+    } else if (head != sequence_heads_.end()) {
+      const SequenceChain& chain = sequence_chains_.at(head->second);
+      matrix_indices.push_back(service.matrix_index());
+      out_matrix_indices.push_back(problem.services(chain.members.back()).matrix_index());
+      std::vector<int64> c_v_i(chain.vehicle_indices);
+      std::vector<int64> c_q(chain.quantities);
+      // Contracted services have neither setup quantities nor refills, one
+      // entry per unit is still expected by the quantity callbacks
+      std::vector<int64> c_s_q(chain.quantities.size(), 0);
+      std::vector<bool> c_r_q(chain.quantities.size(), false);
+      TSPTWClient client((std::string)service.id(),
+                         problem_index,
+                         {chain.ready_time},
+                         {chain.due_time},
+                         chain.service_time,
+                         chain.service_value,
+                         chain.setup_time,
+                         chain.priority,
+                         0,
+                         c_v_i,
+                         c_q,
+                         c_s_q,
+                         chain.exclusion_cost,
+                         c_r_q);
+      client.service_distance = chain.service_distance;
+      client.sequence_members = chain.members;
+      client.sequence_offsets = chain.offsets;
+      for (int32 member: chain.members) {
+        client.sequence_ids.push_back((std::string)problem.services(member).id());
+        ids_map_[(std::string)problem.services(member).id()] = s;
+      }
+      tsptw_clients_.push_back(client);
+      s++;
+    } else if (service.late_multiplier() > 0) {
       do {
         matrix_indices.push_back(service.matrix_index());
+        out_matrix_indices.push_back(service.matrix_index());
         std::vector<int64> start;
         if (timewindows.size() > 0 && timewindows[timewindow_index]->start() > -CUSTOM_MAX_INT)
           start.push_back(timewindows[timewindow_index]->start());
@@ -582,6 +800,7 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
       } while (timewindow_index < service.time_windows_size());
     } else {
       matrix_indices.push_back(service.matrix_index());
+      out_matrix_indices.push_back(service.matrix_index());
       tsptw_clients_.push_back(TSPTWClient((std::string)service.id(),
                                          problem_index,
                                          ready_time,
@@ -599,11 +818,12 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
       ids_map_[(std::string)service.id()] = s;
       s++;
     }
+    ++services_counter;
     ++problem_index;
   }
 
   size_rest_ = 0;
-  size_matrix_ = problem_index + 2;
+  size_matrix_ = services_counter + 2;
   for (const ortools_vrp::Vehicle& vehicle: problem.vehicles()) {
     size_rest_ += vehicle.rests().size();
   }
@@ -657,6 +877,9 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
     std::vector<int64> vehicle_indices(matrix_indices);
     vehicle_indices.push_back(vehicle.start_index());
     vehicle_indices.push_back(vehicle.end_index());
+    std::vector<int64> vehicle_out_indices(out_matrix_indices);
+    vehicle_out_indices.push_back(vehicle.start_index());
+    vehicle_out_indices.push_back(vehicle.end_index());
 
     for (const ortools_vrp::Capacity& capacity: vehicle.capacities()) {
       v->capacity.push_back(capacity.limit());
@@ -669,6 +892,7 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
     v->problem_matrix_index = vehicle.matrix_index();
     v->value_matrix_index = vehicle.value_matrix_index();
     v->vehicle_indices = vehicle_indices;
+    v->vehicle_out_indices = vehicle_out_indices;
     v->time_start = vehicle.time_window().start() > -CUSTOM_MAX_INT ? vehicle.time_window().start() : -CUSTOM_MAX_INT;
     v->time_end = vehicle.time_window().end() < CUSTOM_MAX_INT ? vehicle.time_window().end() : CUSTOM_MAX_INT;
     v->late_multiplier = (int64)(vehicle.cost_late_multiplier() * 1000);
@@ -736,7 +960,9 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
     ++v_index;
   }
 
+  int32 relation_index = 0;
   for (const ortools_vrp::Relation& relation: problem.relations()) {
+    if (contracted_relations_.count(relation_index++) > 0) continue;
     std::vector<std::string>* linked_ids = new std::vector<std::string>();
     for (const std::string linked_id: relation.linked_ids()) {
       linked_ids->push_back(linked_id);
@@ -764,6 +990,8 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
     ++re_index;
   }
 
+  if (FLAGS_unserviceable_presolve) RemoveUnserviceableServices();
+
   // Compute horizon
   horizon_ = 0;
   max_service_ = 0;
@@ -781,6 +1009,389 @@ void TSPTWDataDT::LoadInstance(const std::string & filename) {
   }
 }
 
+//  Services contracted into a single node are visited one right after the
+//  other by the same vehicle. The node duration includes the inner travels
+//  and its time window is shifted from the member windows, assuming no
+//  waiting inside the chain. Inner travels are read from the matrix shared
+//  by every vehicle.
+void TSPTWDataDT::PrepareContraction(const ortools_vrp::Problem& problem) {
+  if (problem.vehicles_size() == 0) return;
+
+  const ortools_vrp::Vehicle& reference = problem.vehicles(0);
+  for (const ortools_vrp::Vehicle& vehicle: problem.vehicles()) {
+    if (vehicle.matrix_index() != reference.matrix_index() || vehicle.max_ride_time() != reference.max_ride_time() ||
+        vehicle.max_ride_distance() != reference.max_ride_distance())
+      return;
+  }
+  if (reference.matrix_index() >= problem.matrices_size()) return;
+
+  if (FLAGS_sequence_contraction) PrepareSequenceContraction(problem);
+  if (FLAGS_colocated_aggregation) PrepareColocatedAggregation(problem);
+}
+
+bool TSPTWDataDT::ContractibleService(const ortools_vrp::Service& service) const {
+  if (service.late_multiplier() > 0 || service.time_windows_size() > 1) return false;
+  for (const bool refill: service.refill_quantities()) {
+    if (refill) return false;
+  }
+  for (const int32 setup_quantity: service.setup_quantities()) {
+    if (setup_quantity != 0) return false;
+  }
+  return true;
+}
+
+//  Computes the node built from chain->members, returns false if the
+//  members can't be visited in a row by one vehicle.
+bool TSPTWDataDT::BuildSequenceChain(const ortools_vrp::Problem& problem, SequenceChain* chain) const {
+  const ortools_vrp::Vehicle& reference = problem.vehicles(0);
+  const ortools_vrp::Matrix& matrix = problem.matrices(reference.matrix_index());
+  const int32 time_size = sqrt(matrix.time_size());
+  const int32 distance_size = sqrt(matrix.distance_size());
+
+  int64 offset = 0;
+  bool all_vehicles = true;
+  std::set<int64> allowed_vehicles;
+  for (int32 m = 0; m < chain->members.size(); ++m) {
+    const ortools_vrp::Service& service = problem.services(chain->members[m]);
+    chain->offsets.push_back(offset);
+
+    if (service.time_windows_size() > 0) {
+      const ortools_vrp::TimeWindow& tw = service.time_windows(0);
+      if (tw.start() > -CUSTOM_MAX_INT)
+        chain->ready_time = std::max(chain->ready_time, tw.start() - offset);
+      if (tw.end() < CUSTOM_MAX_INT)
+        chain->due_time = std::min(chain->due_time, tw.end() - offset);
+    }
+
+    if (service.vehicle_indices_size() > 0 && std::find(service.vehicle_indices().begin(), service.vehicle_indices().end(), -1) == service.vehicle_indices().end()) {
+      std::set<int64> service_vehicles(service.vehicle_indices().begin(), service.vehicle_indices().end());
+      if (all_vehicles) {
+        allowed_vehicles = service_vehicles;
+      } else {
+        std::set<int64> intersection;
+        std::set_intersection(allowed_vehicles.begin(), allowed_vehicles.end(), service_vehicles.begin(), service_vehicles.end(),
+                              std::inserter(intersection, intersection.begin()));
+        allowed_vehicles = intersection;
+      }
+      all_vehicles = false;
+    }
+
+    chain->quantities.resize(std::max(chain->quantities.size(), (size_t)service.quantities_size()), 0);
+    for (int32 q = 0; q < service.quantities_size(); ++q) {
+      chain->quantities[q] += service.quantities(q);
+    }
+    chain->service_value += service.additional_value();
+    chain->priority = m == 0 ? service.priority() : std::min(chain->priority, (int32)service.priority());
+    if (chain->exclusion_cost != -1)
+      chain->exclusion_cost = service.exclusion_cost() == -1 ? -1 : chain->exclusion_cost + service.exclusion_cost();
+
+    offset += service.duration();
+    if (m + 1 < chain->members.size()) {
+      const ortools_vrp::Service& next = problem.services(chain->members[m + 1]);
+      int64 time = 0;
+      int64 distance = 0;
+      if (service.matrix_index() < time_size && next.matrix_index() < time_size)
+        time = static_cast<int64>(matrix.time(service.matrix_index() * time_size + next.matrix_index()) + 0.5);
+      if (service.matrix_index() < distance_size && next.matrix_index() < distance_size)
+        distance = static_cast<int64>(matrix.distance(service.matrix_index() * distance_size + next.matrix_index()));
+      if (reference.max_ride_time() > 0 && time > reference.max_ride_time() ||
+          reference.max_ride_distance() > 0 && distance > reference.max_ride_distance()) return false;
+      offset += time + (time > 0 ? service.setup_duration() : 0);
+      chain->service_distance += distance;
+      chain->service_value += time;
+    } else {
+      chain->setup_time = service.setup_duration();
+    }
+  }
+  chain->service_time = offset;
+  if (!all_vehicles) {
+    if (allowed_vehicles.empty()) return false;
+    chain->vehicle_indices.assign(allowed_vehicles.begin(), allowed_vehicles.end());
+  }
+  return chain->ready_time <= chain->due_time;
+}
+
+void TSPTWDataDT::AddSequenceChain(const SequenceChain& chain) {
+  sequence_heads_[chain.members.front()] = sequence_chains_.size();
+  for (int32 m = 1; m < chain.members.size(); ++m) {
+    sequence_tails_.insert(chain.members[m]);
+  }
+  sequence_chains_.push_back(chain);
+}
+
+//  A sequence relation forces its services to be visited one right after
+//  the other by the same vehicle, its chain is contracted unless one of its
+//  services is involved in another relation.
+void TSPTWDataDT::PrepareSequenceContraction(const ortools_vrp::Problem& problem) {
+  std::map<std::string, int32> ordinals;
+  for (int32 i = 0; i < problem.services_size(); ++i) {
+    ordinals[(std::string)problem.services(i).id()] = i;
+  }
+
+  std::map<std::string, int32> occurrences;
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    for (const std::string linked_id: relation.linked_ids()) {
+      ++occurrences[linked_id];
+    }
+  }
+
+  int32 relation_index = -1;
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    ++relation_index;
+    if (relation.type() != "sequence" || relation.linked_ids_size() < 2) continue;
+
+    SequenceChain chain;
+    bool valid = true;
+    for (const std::string linked_id: relation.linked_ids()) {
+      std::map<std::string, int32>::const_iterator it = ordinals.find(linked_id);
+      if (it == ordinals.end() || occurrences[linked_id] > 1 || !ContractibleService(problem.services(it->second))) {
+        valid = false;
+        break;
+      }
+      chain.members.push_back(it->second);
+    }
+    if (!valid || !BuildSequenceChain(problem, &chain)) continue;
+
+    AddSequenceChain(chain);
+    contracted_relations_.insert(relation_index);
+  }
+}
+
+//  Services sharing a matrix index, the same vehicles and priority are
+//  visited in a row, ordered by time window. A group is split when adding
+//  a service would exceed the aggregation limits or empty the time window.
+void TSPTWDataDT::PrepareColocatedAggregation(const ortools_vrp::Problem& problem) {
+  std::set<std::string> related;
+  for (const ortools_vrp::Relation& relation: problem.relations()) {
+    related.insert(relation.linked_ids().begin(), relation.linked_ids().end());
+  }
+
+  std::map<std::vector<int64>, std::vector<int32>> groups;
+  for (int32 i = 0; i < problem.services_size(); ++i) {
+    const ortools_vrp::Service& service = problem.services(i);
+    if (service.no_aggregation() || related.count(service.id()) > 0 || sequence_heads_.count(i) > 0 || sequence_tails_.count(i) > 0 ||
+        !ContractibleService(service))
+      continue;
+    std::vector<int64> key = {service.matrix_index(), service.priority()};
+    std::set<int64> service_vehicles(service.vehicle_indices().begin(), service.vehicle_indices().end());
+    if (service_vehicles.count(-1) == 0) key.insert(key.end(), service_vehicles.begin(), service_vehicles.end());
+    groups[key].push_back(i);
+  }
+
+  for (std::pair<const std::vector<int64>, std::vector<int32>>& group: groups) {
+    if (group.second.size() < 2) continue;
+    std::vector<int32>& members = group.second;
+    std::stable_sort(members.begin(), members.end(), [&problem](int32 a, int32 b) {
+      const ortools_vrp::Service& service_a = problem.services(a);
+      const ortools_vrp::Service& service_b = problem.services(b);
+      const int64 ready_a = service_a.time_windows_size() > 0 ? service_a.time_windows(0).start() : -CUSTOM_MAX_INT;
+      const int64 ready_b = service_b.time_windows_size() > 0 ? service_b.time_windows(0).start() : -CUSTOM_MAX_INT;
+      return ready_a < ready_b;
+    });
+
+    SequenceChain chain;
+    for (int32 member: members) {
+      SequenceChain candidate;
+      candidate.members = chain.members;
+      candidate.members.push_back(member);
+      if ((FLAGS_aggregation_max_services == 0 || candidate.members.size() <= FLAGS_aggregation_max_services) &&
+          BuildSequenceChain(problem, &candidate) &&
+          (FLAGS_aggregation_max_duration == 0 || candidate.service_time <= FLAGS_aggregation_max_duration)) {
+        chain = candidate;
+      } else {
+        if (chain.members.size() > 1) AddSequenceChain(chain);
+        chain = SequenceChain();
+        chain.members.push_back(member);
+        BuildSequenceChain(problem, &chain);
+      }
+    }
+    if (chain.members.size() > 1) AddSequenceChain(chain);
+  }
+}
+
+//  A node can be served if at least one allowed vehicle can carry its
+//  quantities and reach it within its hard time window and its own shift.
+bool TSPTWDataDT::NodeServiceable(RoutingModel::NodeIndex i) const {
+  const TSPTWClient& client = tsptw_clients_[i.value()];
+  for (int32 v = 0; v < tsptw_vehicles_.size(); ++v) {
+    const Vehicle* vehicle = tsptw_vehicles_[v];
+    bool allowed = client.vehicle_indices.size() == 0;
+    for (int64 index: client.vehicle_indices) {
+      allowed |= index == v || index == -1;
+    }
+    if (!allowed) continue;
+
+    bool fits = true;
+    for (int32 q = 0; q < client.quantities.size() && q < vehicle->capacity.size(); ++q) {
+      const bool refill = q < client.refill_quantities.size() && client.refill_quantities[q];
+      const bool setup = q < client.setup_quantities.size() && client.setup_quantities[q] != 0;
+      if (vehicle->capacity[q] >= 0 && vehicle->overload_multiplier[q] == 0 && !refill && !setup &&
+          std::abs(client.quantities[q]) > vehicle->capacity[q])
+        fits = false;
+    }
+    if (!fits) continue;
+
+    int64 arrival = vehicle->time_start + vehicle->TimePlusServiceTime(vehicle->start, i);
+    if (client.ready_time.size() > 0) arrival = std::max(arrival, client.ready_time.at(0));
+    if (client.late_multiplier == 0 && client.due_time.size() > 0 && arrival > client.due_time.back()) continue;
+    if (vehicle->late_multiplier == 0 && vehicle->time_end < CUSTOM_MAX_INT &&
+        arrival + vehicle->TimePlusServiceTime(i, vehicle->stop) > vehicle->time_end) continue;
+    return true;
+  }
+  return false;
+}
+
+//  Services which can't be served are removed before the model is built,
+//  so they don't get nodes nor disjunctions and stay out of every route.
+//  Services linked by relations are kept as relations refer to their nodes.
+void TSPTWDataDT::RemoveUnserviceableServices() {
+  if (tsptw_vehicles_.size() == 0) return;
+
+  std::set<std::string> related;
+  for (Relation* relation: tsptw_relations_) {
+    related.insert(relation->linked_ids->begin(), relation->linked_ids->end());
+  }
+
+  // A service with several nodes is kept if any of them can be served
+  std::map<std::string, bool> serviceable;
+  for (RoutingModel::NodeIndex i(0); i < size_ - 2; ++i) {
+    const std::string& id = tsptw_clients_[i.value()].customer_id;
+    bool& keep = serviceable[id];
+    keep = keep || related.count(id) > 0 || NodeServiceable(i);
+  }
+
+  std::vector<int64> new_indices(size_, -1);
+  std::vector<TSPTWClient> clients;
+  for (int32 i = 0; i < size_; ++i) {
+    if (i >= size_ - 2 || serviceable[tsptw_clients_[i].customer_id]) {
+      new_indices[i] = clients.size();
+      clients.push_back(tsptw_clients_[i]);
+    }
+  }
+  if (clients.size() == size_) return;
+
+  for (const std::pair<std::string, bool>& service: serviceable) {
+    if (!service.second) unserviceable_ids_.push_back(service.first);
+  }
+  for (std::map<std::string, int64>::iterator it = ids_map_.begin(); it != ids_map_.end(); ) {
+    if (new_indices[it->second] == -1) {
+      it = ids_map_.erase(it);
+    } else {
+      it->second = new_indices[it->second];
+      ++it;
+    }
+  }
+  for (Vehicle* v: tsptw_vehicles_) {
+    std::vector<int64> vehicle_indices;
+    std::vector<int64> vehicle_out_indices;
+    for (int32 i = 0; i < size_; ++i) {
+      if (new_indices[i] == -1) continue;
+      vehicle_indices.push_back(v->vehicle_indices[i]);
+      vehicle_out_indices.push_back(v->vehicle_out_indices[i]);
+    }
+    v->vehicle_indices = vehicle_indices;
+    v->vehicle_out_indices = vehicle_out_indices;
+    v->size = clients.size();
+    v->start = RoutingModel::NodeIndex(clients.size() - 2);
+    v->stop = RoutingModel::NodeIndex(clients.size() - 1);
+  }
+
+  tsptw_clients_ = clients;
+  size_ = clients.size();
+  size_matrix_ -= unserviceable_ids_.size();
+}
+
+//  An arc (i, j) can't be used by a vehicle if it allows no arrival at j
+//  within its hard time window, or no return to the vehicle end in time.
+//  Vehicles sharing start, end, matrix, ride limits and time window are
+//  checked once, a row of arcs at a time. Service arcs are removed when no
+//  vehicle can use them, start and end arcs per vehicle. Without hard time
+//  windows, hard vehicle ends nor ride limits there is nothing to remove.
+void TSPTWDataDT::ComputeArcElimination(int64 horizon) const {
+  const int32 size = size_ - 2;
+  const int size_vehicles = tsptw_vehicles_.size();
+  arc_elimination_.removed_next.assign(size, std::vector<int32>());
+  arc_elimination_.unreachable.assign(size_vehicles, std::vector<int32>());
+  if (size_vehicles == 0) return;
+
+  std::vector<int64> earliest(size);
+  std::vector<int64> latest(size);
+  bool tight = false;
+  for (RoutingModel::NodeIndex i(0); i < size; ++i) {
+    const TSPTWClient& client = tsptw_clients_[i.value()];
+    earliest[i.value()] = client.ready_time.size() > 0 ? client.ready_time.at(0) : -CUSTOM_MAX_INT;
+    latest[i.value()] = client.due_time.size() > 0 && client.late_multiplier == 0 ? client.due_time.back() : CUSTOM_MAX_INT;
+    tight |= latest[i.value()] < CUSTOM_MAX_INT;
+  }
+
+  std::map<std::vector<int64>, std::vector<int>> classes;
+  for (int v = 0; v < size_vehicles; ++v) {
+    const Vehicle* vehicle = tsptw_vehicles_[v];
+    const int64 time_end = vehicle->late_multiplier > 0 ? CUSTOM_MAX_INT : vehicle->time_end;
+    tight |= time_end < CUSTOM_MAX_INT || vehicle->max_ride_time_ > 0 || vehicle->max_ride_distance_ > 0;
+    classes[{vehicle->problem_matrix_index, vehicle->max_ride_time_, vehicle->max_ride_distance_,
+             vehicle->vehicle_indices.at(vehicle->size - 2), vehicle->vehicle_indices.at(vehicle->size - 1),
+             vehicle->time_start, time_end}].push_back(v);
+  }
+  if (!tight) return;
+
+  //  Earliest arrival at each node from the start of a class, time to its
+  //  end from there, and the nodes one of its vehicles may serve in time
+  struct ClassReach {
+    const Vehicle* vehicle;
+    int64 time_end;
+    std::vector<bool> allowed;
+    std::vector<bool> reachable;
+    std::vector<int64> arrival;
+    std::vector<int64> departure;
+  };
+  std::vector<ClassReach> reaches;
+  for (const std::pair<const std::vector<int64>, std::vector<int>>& vehicle_class : classes) {
+    ClassReach reach;
+    reach.vehicle = tsptw_vehicles_[vehicle_class.second.front()];
+    reach.time_end = vehicle_class.first.back();
+    reach.allowed.assign(size, false);
+    reach.reachable.assign(size, false);
+    reach.arrival.resize(size);
+    reach.departure.resize(size);
+    for (RoutingModel::NodeIndex i(0); i < size; ++i) {
+      const std::vector<int64>& indices = tsptw_clients_[i.value()].vehicle_indices;
+      for (int v : vehicle_class.second) {
+        reach.allowed[i.value()] = reach.allowed[i.value()] || indices.empty() ||
+          std::find(indices.begin(), indices.end(), v) != indices.end() || std::find(indices.begin(), indices.end(), -1) != indices.end();
+      }
+      reach.arrival[i.value()] = std::max(earliest[i.value()], reach.vehicle->time_start + reach.vehicle->TimePlusServiceTime(reach.vehicle->start, i));
+      reach.departure[i.value()] = reach.vehicle->TimePlusServiceTime(i, reach.vehicle->stop);
+      reach.reachable[i.value()] = reach.arrival[i.value()] <= latest[i.value()] && reach.arrival[i.value()] + reach.departure[i.value()] <= reach.time_end;
+      if (!reach.allowed[i.value()] || reach.reachable[i.value()]) continue;
+      for (int v : vehicle_class.second) {
+        arc_elimination_.unreachable[v].push_back(i.value());
+      }
+      arc_elimination_.removed_arcs += 2 * vehicle_class.second.size();
+    }
+    reaches.push_back(reach);
+  }
+
+  std::vector<bool> feasible(size);
+  for (RoutingModel::NodeIndex i(0); i < size; ++i) {
+    feasible.assign(size, false);
+    for (const ClassReach& reach : reaches) {
+      if (!reach.allowed[i.value()] || !reach.reachable[i.value()]) continue;
+      for (RoutingModel::NodeIndex j(0); j < size; ++j) {
+        if (i == j || !reach.allowed[j.value()] || feasible[j.value()]) continue;
+        const int64 transit = reach.vehicle->TimePlusServiceTime(i, j);
+        const int64 arrival_j = std::max(earliest[j.value()], reach.arrival[i.value()] + transit);
+        feasible[j.value()] = transit <= horizon && arrival_j <= latest[j.value()] && arrival_j + reach.departure[j.value()] <= reach.time_end;
+      }
+    }
+    std::vector<int32>& removed = arc_elimination_.removed_next[i.value()];
+    for (int32 j = 0; j < size; ++j) {
+      if (i.value() != j && !feasible[j]) removed.push_back(j);
+    }
+    arc_elimination_.removed_arcs += removed.size();
+  }
+}
+
 }  //  namespace operations_research
 
 #endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_TSP_DATA_DT_H